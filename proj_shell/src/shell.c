@@ -10,9 +10,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <wait.h>
+#include <spawn.h>
 
 #define LINE_MAX_SIZE 4096
 
+extern char **environ;
+
 // Define Parsing States
 #define PS_EMPTY 1
 #define PS_NORMAL_STRING 2
@@ -191,19 +194,13 @@ int main (int argc, char *argv[]) {
 				break;
 			}
 
-			pid = fork(); // Make child process
-
-			if (pid < 0) {
-				printf("fork failed");
-
-			}else if (pid == 0) {
-				// Child process
-				execvp(command[0], command); // Run commands
-				exit(-1); // If error, this line would be executed
+			// Start the command in a child process, without
+			// copying the shell as fork() and exec would
+			if (posix_spawnp(&pid, command[0], NULL, NULL, command, environ) != 0) {
+				printf("Command fails\n");
 
 			}else {
-				// Parent process
-				wait(&status);
+				waitpid(pid, &status, 0);
 
 				if (status != 0) {
 					printf("Command fails\n");
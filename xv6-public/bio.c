@@ -25,6 +25,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
 
 struct {
   struct spinlock lock;
@@ -139,6 +140,24 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+
+// Fill in the buffer cache counts of ms.
+void
+bstat(struct memstat *ms)
+{
+  struct buf *b;
+
+  ms->nbuf = NBUF;
+  ms->bufvalid = ms->bufbusy = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    if(b->flags & B_VALID)
+      ms->bufvalid++;
+    if(b->refcnt > 0)
+      ms->bufbusy++;
+  }
+  release(&bcache.lock);
+}
 //PAGEBREAK!
 // Blank page.
 
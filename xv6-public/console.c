@@ -179,6 +179,7 @@ consputc(int c)
 }
 
 #define INPUT_BUF 128
+#define CONSBUF 256  // bytes copied to or from the caller at once
 struct {
   char buf[INPUT_BUF];
   uint r;  // Read index
@@ -232,14 +233,19 @@ consoleintr(int (*getc)(void))
   }
 }
 
+// The caller's memory is copied to or from a buffer on the
+// kernel stack without cons.lock held: touching it may fault and
+// sleep to read a page back from swap.
 int
 consoleread(struct inode *ip, char *dst, int n)
 {
+  char buf[CONSBUF];
   uint target;
-  int c;
+  int c, m;
 
   iunlock(ip);
   target = n;
+  m = 0;
   acquire(&cons.lock);
   while(n > 0){
     while(input.r == input.w){
@@ -259,27 +265,40 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    buf[m++] = c;
     --n;
     if(c == '\n')
       break;
+    if(m == CONSBUF){
+      release(&cons.lock);
+      memmove(dst, buf, m);
+      dst += m;
+      m = 0;
+      acquire(&cons.lock);
+    }
   }
   release(&cons.lock);
+  memmove(dst, buf, m);
   ilock(ip);
 
   return target - n;
 }
 
 int
-consolewrite(struct inode *ip, char *buf, int n)
+consolewrite(struct inode *ip, char *src, int n)
 {
-  int i;
+  char buf[CONSBUF];
+  int i, j, m;
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  for(i = 0; i < n; i += m){
+    m = n - i < CONSBUF ? n - i : CONSBUF;
+    memmove(buf, src + i, m);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(buf[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
@@ -0,0 +1,96 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "x86.h"
+
+// Measure how fast the kernel copies memory, in bytes per cycle
+// of the time-stamp counter: reading a file that is in the buffer
+// cache (memmove() from a block to the user's buffer), and writing
+// to copy-on-write pages after fork() (pagecopy(), with the cost
+// of the page fault).
+//
+// usage: copybench
+
+#define FILESIZE  (8*1024)   // fits in the buffer cache
+#define NREAD     200
+#define NPAGES    1024
+#define PGSIZE    4096
+
+char buf[FILESIZE];
+
+// The user library has no 64-bit division: count cycles in
+// units of 256, and bytes likewise.
+void
+report(char *what, uint bytes, uvlong cycles)
+{
+  uint c, x;
+
+  c = (uint)(cycles >> 8);
+  x = bytes / 256 * 100 / (c ? c : 1);
+  printf(1, "%s: %d bytes in %d x 256 cycles, %d.%d%d bytes/cycle\n",
+         what, bytes, c, x / 100, x / 10 % 10, x % 10);
+}
+
+void
+readbench(void)
+{
+  int fd, i;
+  uvlong start;
+
+  if((fd = open("copybench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(1, "copybench: cannot create file\n");
+    exit();
+  }
+  memset(buf, 'x', FILESIZE);
+  if(write(fd, buf, FILESIZE) != FILESIZE){
+    printf(1, "copybench: write failed\n");
+    exit();
+  }
+
+  // Once to bring the blocks into the cache.
+  pread(fd, buf, FILESIZE, 0);
+  start = rdtsc();
+  for(i = 0; i < NREAD; i++){
+    if(pread(fd, buf, FILESIZE, 0) != FILESIZE){
+      printf(1, "copybench: read failed\n");
+      exit();
+    }
+  }
+  report("read", NREAD * FILESIZE, rdtsc() - start);
+  close(fd);
+  unlink("copybench.tmp");
+}
+
+void
+cowbench(void)
+{
+  char *mem;
+  int i;
+  uvlong start;
+
+  if((mem = sbrk(NPAGES * PGSIZE)) == (char*)-1){
+    printf(1, "copybench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < NPAGES; i++)
+    mem[i * PGSIZE] = i;
+
+  if(fork() == 0){
+    start = rdtsc();
+    for(i = 0; i < NPAGES; i++)
+      mem[i * PGSIZE] = 0;
+    report("copy-on-write", NPAGES * PGSIZE, rdtsc() - start);
+    exit();
+  }
+  wait();
+  sbrk(-NPAGES * PGSIZE);
+}
+
+int
+main(int argc, char *argv[])
+{
+  readbench();
+  cowbench();
+  exit();
+}
@@ -0,0 +1,144 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Test copy-on-write fork, and measure fork latency
+// for a parent with a large address space.
+
+#define NPAGES  2048   // 8MB
+#define NFORK   20
+
+char *mem;
+
+void
+fill(int v)
+{
+  int i;
+
+  for(i = 0; i < NPAGES; i++)
+    mem[i * 4096] = v;
+}
+
+int
+check(int v)
+{
+  int i;
+
+  for(i = 0; i < NPAGES; i++)
+    if(mem[i * 4096] != v)
+      return -1;
+  return 0;
+}
+
+void
+test1()
+{
+  int pid, fds[2];
+  char c;
+
+  // Parent and child must not see each other's writes.
+  fill(1);
+  pipe(fds);
+  pid = fork();
+  if(pid < 0){
+    printf(1, "panic at fork\n");
+    return;
+  }
+  if(pid == 0){
+    fill(2);
+    if(check(2) < 0)
+      printf(1, "panic at test1 (child)\n");
+    write(fds[1], "x", 1);
+    exit();
+  }
+  read(fds[0], &c, 1);
+  if(check(1) < 0){
+    printf(1, "panic at test1 (parent sees child's writes)\n");
+    return;
+  }
+  fill(3);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  printf(1, "Test 1 is done!\n");
+}
+
+volatile int go;
+
+void*
+writer(void *arg)
+{
+  while(!go)
+    ;
+  fill(4);
+  thread_exit(0);
+}
+
+void
+test2()
+{
+  thread_t t;
+  void *retval;
+  int pid;
+
+  // A thread keeps writing while its process forks:
+  // the child gets a consistent snapshot of each page,
+  // and the thread's writes land in the parent.
+  fill(1);
+  go = 0;
+  if(thread_create(&t, writer, 0) != 0){
+    printf(1, "panic at thread_create\n");
+    return;
+  }
+  go = 1;
+  pid = fork();
+  if(pid == 0){
+    exit();
+  }
+  thread_join(t, &retval);
+  wait();
+  if(check(4) < 0){
+    printf(1, "panic at test2 (lost thread's writes)\n");
+    return;
+  }
+  printf(1, "Test 2 is done!\n");
+}
+
+void
+test3()
+{
+  int i, start, pid;
+
+  fill(5);
+  start = uptime();
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  printf(1, "%d forks of a %dKB process in %d ticks\n",
+         NFORK, NPAGES * 4, uptime() - start);
+  printf(1, "Test 3 is done!\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if((mem = sbrk(NPAGES * 4096)) == (char*)-1){
+    printf(1, "cowtest: sbrk failed\n");
+    exit();
+  }
+
+  printf(1, "===========Test1===========\n");
+  test1();
+
+  printf(1, "===========Test2===========\n");
+  test2();
+
+  printf(1, "===========Test3===========\n");
+  test3();
+
+  printf(1, "All tests are done\n");
+  exit();
+}
@@ -0,0 +1,71 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// Context-switch benchmark: two processes pass a byte back and
+// forth through a pair of pipes, so that each round trip is two
+// switches through the scheduler. Reports cycles of the
+// time-stamp counter per switch. Run it with one CPU
+// (`make qemu CPUS=1`) so that the processes cannot run side by
+// side.
+//
+// The cost of a switch includes the TLB misses that follow the
+// %cr3 load; global kernel mappings (PTE_G) keep the kernel's own
+// entries across it.
+//
+// usage: ctxbench [rounds]
+
+int
+main(int argc, char *argv[])
+{
+  int p1[2], p2[2], i, n, pid;
+  uvlong start, cycles;
+  uint k;
+  char c;
+
+  n = 10000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    printf(2, "usage: ctxbench [rounds]\n");
+    exit();
+  }
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf(1, "ctxbench: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "ctxbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      if(read(p1[0], &c, 1) != 1)
+        break;
+      write(p2[1], &c, 1);
+    }
+    exit();
+  }
+
+  c = 0;
+  start = rdtsc();
+  for(i = 0; i < n; i++){
+    write(p1[1], &c, 1);
+    if(read(p2[0], &c, 1) != 1){
+      printf(1, "ctxbench: read failed\n");
+      break;
+    }
+  }
+  cycles = rdtsc() - start;
+  wait();
+
+  // The user library has no 64-bit division: divide in units
+  // of 1024 cycles, and the remainder separately.
+  k = (uint)(cycles >> 10);
+  printf(1, "%d round trips, %d cycles per switch\n",
+         n, k / (2*n) * 1024 + k % (2*n) * 1024 / (2*n));
+  exit();
+}
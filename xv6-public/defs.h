@@ -1,18 +1,26 @@
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
+struct kmcache;
+struct memstat;
 struct pipe;
 struct proc;
+struct procmem;
 struct rtcdate;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vm;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            bstat(struct memstat*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -23,9 +31,18 @@ void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
 // exec.c
+struct vm*      execload(char*, char**, uint*, uint*);
+char*           execname(char*);
 int             exec(char*, char**);
 
 // file.c
+int             fdalloc(struct fdtable*, struct file*);
+void            fdcloseall(struct fdtable*);
+int             fdcopy(struct fdtable*, struct fdtable*);
+struct file*    fdget(struct fdtable*, int);
+void            fdinit(struct fdtable*);
+int             fdinstall(struct fdtable*, int, struct file*);
+struct file*    fdremove(struct fdtable*, int);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
@@ -66,20 +83,37 @@ void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// slab.c
+void            kminit(void);
+struct kmcache* kmcreate(char*, uint, void(*)(void*));
+void*           kmalloc(struct kmcache*);
+void            kmfree(struct kmcache*, void*);
+
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
+void            kzerofill(void);
 void            kfree(char*);
+void            kref(char*);
+int             krefcount(char*);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
+void            kallocdump(void);
+void            kallocstat(struct memstat*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+extern uint     physend;
 
 // kbd.c
 void            kbdintr(void);
 
 // lapic.c
 void            cmostime(struct rtcdate *r);
+uint            cmosmemsize(void);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(uchar, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -90,6 +124,18 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+int             mmap(struct vm*, uint, int, int, struct file*, uint);
+int             mmapshm(struct vm*, struct shm*, uint);
+int             munmap(struct vm*, uint, uint);
+void            msync(struct vm*, uint, uint);
+struct vma*     mmapfind(struct vm*, uint);
+void            mmapread(struct file*, char*, uint, uint);
+int             mmapexec(struct vm*, uint, uint, struct file*, uint, uint);
+void            mmapdup(struct vm*, struct vm*);
+void            mmapclose(struct vm*);
+int             checkuva(uint, uint, int);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -100,17 +146,21 @@ void            picinit(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
 
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             spawn(char*, char**, int*, int);
+int             procmem(struct procmem*, int);
 int             growproc(int);
 int             kill(int);
+void            setparent(struct proc*, struct proc*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -128,6 +178,8 @@ int             set_cpu_share(int);
 int             thread_create(thread_t* thread, void* (*start_routine)(void*), void* arg);           
 void            thread_exit(void* retval);
 int             thread_join(thread_t thread, void** retval);
+int             thread_join_any(thread_t* thread, void** retval);
+int             thread_detach(thread_t thread);
 void            kill_except(int, struct proc*);
 void            wakeup_except(int, struct proc*);
 
@@ -143,6 +195,16 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+int             shmat(struct vm*, int);
+int             shmdt(struct vm*, uint);
+int             shmrm(int);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+char*           shmpage(struct shm*, int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -153,14 +215,35 @@ void            initsleeplock(struct sleeplock*, char*);
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
+void            pagecopy(void*, const void*);
+void            pagezero(void*);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
+void            sseinit(void);
+
+// text.c
+void            textinit(void);
+char*           textpage(struct inode*, uint);
+void            textinval(struct inode*);
+int             textshrink(int);
+void            textstat(struct memstat*);
+
+// swap.c
+void            swapinit(int);
+int             swapalloc(void);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapread(char*, uint);
+void            swapwrite(char*, uint);
+void            swapdump(void);
+void            swapstat(struct memstat*);
 
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argout(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -189,12 +272,23 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(struct vm*);
+int             pagefault(uint, uint);
+int             uvmpresent(struct vm*, uint);
+void            uvmstat(struct vm*, struct procmem*);
+int             reclaim(int);
+uint            takedirty(struct vm*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+void            vminit(void);
+struct vm*      vmcreate(pde_t*, uint);
+struct vm*      vmdup(struct vm*);
+void            vmput(struct vm*);
+int             vmdealloc(struct vm*, uint, uint);
+void            tlbshootdown(struct vm*, uint, uint);
+void            tlbflushpending(void);
 
 //prac_syscall.c
 int		printk_str(char*);
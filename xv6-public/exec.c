@@ -6,39 +6,42 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "vm.h"
 
-int
-exec(char *path, char **argv)
+// Load the program at path into a new address space, with argv
+// on its stack, for exec() and spawn(). The program's segments
+// are only recorded as regions backed by the file: pagefault()
+// reads each page on first touch, and untouched code, data and
+// bss cost nothing. Returns the address space and sets *entryp
+// and *spp to the entry point and initial stack pointer, or
+// returns 0 on failure.
+struct vm*
+execload(char *path, char **argv, uint *entryp, uint *spp)
 {
-  char *s, *last;
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
-  int oldtid = 0;
-
-  // If curproc is slave thread, inherit parent and promote to master
-  if(curproc->master){
-    curproc->parent = curproc->master->parent;
-    curproc->master = 0;
-    oldtid = curproc->tid;
-    curproc->tid = 0;
-  }
-  kill_except(curproc->pid, curproc);
-  
+  struct file *f;
+  struct vm *vm;
+  pde_t *pgdir;
 
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
     cprintf("exec: fail\n");
-    return -1;
+    return 0;
   }
   ilock(ip);
   pgdir = 0;
+  vm = 0;
+  f = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -48,8 +51,21 @@ exec(char *path, char **argv)
 
   if((pgdir = setupkvm()) == 0)
     goto bad;
+  // The size stays 0 until the image is complete, so that
+  // reclaim() leaves it alone.
+  if((vm = vmcreate(pgdir, 0)) == 0)
+    goto bad;
+
+  // The segments share one read-only open file of the program.
+  if((f = filealloc()) == 0)
+    goto bad;
+  f->type = FD_INODE;
+  f->ip = idup(ip);
+  f->off = 0;
+  f->readable = 1;
+  f->writable = 0;
 
-  // Load program into memory.
+  // Map program into memory.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -58,18 +74,24 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MMAPBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
+      goto bad;
+    if(ph.memsz == 0)
+      continue;
+    if(mmapexec(vm, ph.vaddr, ph.memsz, f, ph.off, ph.filesz) < 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
+  fileclose(f);
+  f = 0;
 
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible.  Use the second as the user stack.
@@ -98,33 +120,78 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
-  // Save program name for debugging.
+  acquire(&vm->lock);
+  vm->sz = sz;
+  release(&vm->lock);
+  *entryp = elf.entry;
+  *spp = sp;
+  return vm;
+
+ bad:
+  if(ip){
+    iunlockput(ip);
+    end_op();
+  }
+  // Closing files needs a transaction of its own.
+  if(f)
+    fileclose(f);
+  if(vm){
+    mmapclose(vm);
+    vmput(vm);
+  } else if(pgdir)
+    freevm(pgdir);
+  return 0;
+}
+
+// Return the last element of path, for a process name.
+char*
+execname(char *path)
+{
+  char *s, *last;
+
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  return last;
+}
+
+int
+exec(char *path, char **argv)
+{
+  uint sp, entry;
+  struct vm *vm, *oldvm;
+  struct proc *curproc = myproc();
+
+  // If curproc is slave thread, inherit parent and promote to master
+  if(curproc->master){
+    setparent(curproc, curproc->master->parent);
+    curproc->master = 0;
+    curproc->tid = 0;
+  }
+  kill_except(curproc->pid, curproc);
+  
+
+  if((vm = execload(path, argv, &entry, &sp)) == 0)
+    goto bad;
+
+  // Save program name for debugging.
+  safestrcpy(curproc->name, execname(path), sizeof(curproc->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
+  // Old memory is freed when the last thread using it is gone.
+  oldvm = curproc->vm;
+  curproc->vm = vm;
+  curproc->tf->eip = entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   
-  if(oldtid == 0)
-    freevm(oldpgdir);
+  mmapclose(oldvm);
+  vmput(oldvm);
 
   wakeup_except(curproc->pid, curproc);
   return 0;
 
  bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
   wakeup_except(curproc->pid, curproc);
   return -1;
 }
@@ -2,3 +2,12 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800
+
+// fcntl() commands
+#define F_GETFL   1
+#define F_SETFL   2
+
+// Returned by read and write on an O_NONBLOCK pipe
+// instead of waiting for data or space.
+#define EWOULDBLOCK (-2)
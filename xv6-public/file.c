@@ -5,21 +5,31 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 
+// Slots in an fd table block of 2^o pages: a pointer and a bit
+// of the bitmap, which follows the pointers, for each.
+#define FDBLOCK(o)  (((PGSIZE << (o)) * 8 / 33) & ~31)
+
 struct devsw devsw[NDEV];
+
+// Open files are allocated from a slab cache, so their number
+// is limited only by memory. ftable.lock protects the ref counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmcreate("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -28,16 +38,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmalloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +74,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmfree(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -101,7 +107,7 @@ fileread(struct file *f, char *addr, int n)
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
@@ -122,7 +128,7 @@ pfileread(struct file *f, char *addr, int n, int off)
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, addr, off, n)) > 0)
@@ -144,7 +150,7 @@ filewrite(struct file *f, char *addr, int n)
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+    return pipewrite(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -187,7 +193,7 @@ pfilewrite(struct file *f, char *addr, int n, int off)
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+    return pipewrite(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -222,3 +228,141 @@ pfilewrite(struct file *f, char *addr, int n, int off)
 }
 
 
+
+//PAGEBREAK!
+// Set up t with no open files, in its own slots.
+void
+fdinit(struct fdtable *t)
+{
+  int i;
+
+  t->ofile = t->ofile0;
+  t->used = t->used0;
+  t->nfd = NOFILE;
+  t->order = -1;
+  t->hint = 0;
+  memset(t->ofile0, 0, sizeof(t->ofile0));
+  memset(t->used0, 0, sizeof(t->used0));
+  // Bits past the last slot are never free.
+  for(i = NOFILE; i < NELEM(t->used0)*32; i++)
+    t->used0[i/32] |= 1U << (i%32);
+}
+
+// Move t to a block large enough to hold fd.
+// Returns -1 if out of memory.
+static int
+fdgrow(struct fdtable *t, int fd)
+{
+  struct file **ofile;
+  uint *used;
+  int o, i;
+
+  for(o = t->order + 1; o <= KMAXORDER && FDBLOCK(o) <= fd; o++)
+    ;
+  if(o > KMAXORDER || (ofile = (struct file**)kalloc_order(o)) == 0)
+    return -1;
+  memset(ofile, 0, PGSIZE << o);
+  used = (uint*)(ofile + FDBLOCK(o));
+  for(i = 0; i < t->nfd; i++)
+    if((ofile[i] = t->ofile[i]) != 0)
+      used[i/32] |= 1U << (i%32);
+  if(t->order >= 0)
+    kfree_order((char*)t->ofile, t->order);
+  t->ofile = ofile;
+  t->used = used;
+  t->nfd = FDBLOCK(o);
+  t->order = o;
+  return 0;
+}
+
+// Put f in slot fd of t, which must be free, growing t if need be.
+// Takes over file reference from caller on success.
+// Returns -1 if out of memory.
+int
+fdinstall(struct fdtable *t, int fd, struct file *f)
+{
+  if(fd < 0 || (fd >= t->nfd && fdgrow(t, fd) < 0))
+    return -1;
+  if(t->ofile[fd])
+    panic("fdinstall");
+  t->ofile[fd] = f;
+  t->used[fd/32] |= 1U << (fd%32);
+  return 0;
+}
+
+// Put f in the lowest free slot of t.
+// Takes over file reference from caller on success.
+// Returns the fd, or -1 if out of memory.
+int
+fdalloc(struct fdtable *t, struct file *f)
+{
+  int w, nw, fd;
+
+  nw = (t->nfd + 31) / 32;
+  for(w = t->hint; w < nw && t->used[w] == ~0; w++)
+    ;
+  t->hint = w;
+  if(w == nw)
+    fd = t->nfd;
+  else
+    for(fd = w*32; t->used[w] & (1U << (fd%32)); fd++)
+      ;
+  if(fdinstall(t, fd, f) < 0)
+    return -1;
+  return fd;
+}
+
+// Return the file open at fd in t, or 0.
+struct file*
+fdget(struct fdtable *t, int fd)
+{
+  if(fd < 0 || fd >= t->nfd)
+    return 0;
+  return t->ofile[fd];
+}
+
+// Free slot fd of t, and return the file that was open
+// there for the caller to close, or 0.
+struct file*
+fdremove(struct fdtable *t, int fd)
+{
+  struct file *f;
+
+  if((f = fdget(t, fd)) == 0)
+    return 0;
+  t->ofile[fd] = 0;
+  t->used[fd/32] &= ~(1U << (fd%32));
+  if(fd/32 < t->hint)
+    t->hint = fd/32;
+  return f;
+}
+
+// Open each file of src at the same fd in dst, which is empty.
+// Returns -1 if out of memory, leaving dst empty.
+int
+fdcopy(struct fdtable *dst, struct fdtable *src)
+{
+  int fd;
+
+  if(src->nfd > dst->nfd && fdgrow(dst, src->nfd - 1) < 0)
+    return -1;
+  for(fd = 0; fd < src->nfd; fd++)
+    if(src->ofile[fd])
+      fdinstall(dst, fd, filedup(src->ofile[fd]));
+  return 0;
+}
+
+// Close every file of t and give back its block.
+void
+fdcloseall(struct fdtable *t)
+{
+  struct file *f;
+  int fd;
+
+  for(fd = 0; fd < t->nfd; fd++)
+    if((f = fdremove(t, fd)) != 0)
+      fileclose(f);
+  if(t->order >= 0)
+    kfree_order((char*)t->ofile, t->order);
+  fdinit(t);
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;  // O_NONBLOCK: pipe read/write never sleep
   struct pipe *pipe;
   struct inode *ip;
   uint off;
@@ -14,6 +15,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // on icache list, protected by icache.lock
+  struct inode *prev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
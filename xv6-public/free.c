@@ -0,0 +1,53 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+// Show how memory is used, in kilobytes.
+//
+// usage: free
+
+// Print n right-aligned in a field of w characters.
+void
+putn(uint n, int w)
+{
+  char buf[12];
+  int i;
+
+  i = sizeof(buf);
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n && i > 0);
+  for(w -= sizeof(buf) - 1 - i; w > 0; w--)
+    printf(1, " ");
+  printf(1, "%s", buf + i);
+}
+
+#define KB(pages)  ((pages) * 4)
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat ms;
+
+  if(memstat(&ms) < 0){
+    printf(2, "free: memstat failed\n");
+    exit();
+  }
+  printf(1, "             total      used      free    zeroed\n");
+  printf(1, "Mem:    ");
+  putn(KB(ms.total), 10);
+  putn(KB(ms.total - ms.free - ms.zeroed), 10);
+  putn(KB(ms.free), 10);
+  putn(KB(ms.zeroed), 10);
+  printf(1, "\nSwap:   ");
+  putn(KB(ms.swaptotal), 10);
+  putn(KB(ms.swapused), 10);
+  putn(KB(ms.swaptotal - ms.swapused), 10);
+  printf(1, "\nText cache: %d KB\n", KB(ms.text));
+  printf(1, "Buffers: %d of %d blocks hold data, %d in use\n",
+         ms.bufvalid, ms.nbuf, ms.bufbusy);
+  exit();
+}
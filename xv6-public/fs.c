@@ -156,9 +156,11 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries. In-memory inodes come from a slab cache and are on
+// icache.list while ip->ref > 0; the last iput() frees them.
+// Since ip->dev and ip->inum indicate which i-node an entry
+// holds, one must hold icache.lock while using any of ref,
+// dev, inum, next and prev.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -166,18 +168,23 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmcache *cache;
+  struct inode *list;
 } icache;
 
+static void
+inodector(void *v)
+{
+  struct inode *ip = v;
+
+  initsleeplock(&ip->lock, "inode");
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmcreate("inode", sizeof(struct inode), inodector);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -242,31 +249,32 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.list; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Allocate a new cache entry.
+  if((ip = kmalloc(icache.cache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->prev = 0;
+  ip->next = icache.list;
+  if(icache.list)
+    icache.list->prev = ip;
+  icache.list = ip;
   release(&icache.lock);
 
   return ip;
@@ -323,8 +331,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -348,8 +356,18 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  if(ip->prev)
+    ip->prev->next = ip->next;
+  else
+    icache.list = ip->next;
+  if(ip->next)
+    ip->next->prev = ip->prev;
   release(&icache.lock);
+  kmfree(icache.cache, ip);
 }
 
 // Common idiom: unlock, then put.
@@ -487,6 +505,7 @@ itrunc(struct inode *ip)
 {
   int i;
 
+  textinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -566,6 +585,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
       return -1;
     return devsw[ip->major].write(ip, src, n);
   }
+  textinval(ip);
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -600,6 +620,7 @@ writei2(struct inode *ip, char *src, uint off, uint n)
       return -1;
     return devsw[ip->major].write(ip, src, n);
   }
+  textinval(ip);
 
   if(off + n < off)
     return -1;
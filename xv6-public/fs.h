@@ -7,10 +7,11 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                                free bit map | data blocks | swap area]
 //
 // mkfs computes the super block and builds an initial file system. The
-// super block describes the disk layout:
+// super block describes the disk layout. The swap area is not
+// part of the file system: size counts only the blocks before it.
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
@@ -19,6 +20,8 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks
 };
 
 #define NDIRECT 10
@@ -0,0 +1,408 @@
+// M:N green threads.
+//
+// Each green thread has a GT_STACKSIZE-aligned stack with its
+// struct gthread at the lowest address, so the running green
+// thread is found from %esp without asking the kernel.
+// A carrier switches to a green thread with gtswtch() and the
+// green thread switches back to the carrier's scheduler context
+// to yield, park or exit. Only the carrier puts the green thread
+// back on a queue, once its context has been saved, so another
+// carrier never steals a thread that is still running.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "fcntl.h"
+#include "gthread.h"
+
+#define GT_CHUNK  16   // stacks allocated at a time
+#define GT_SPINS  64   // idle rounds before a carrier gives up the CPU
+#define GT_REPOLL 16   // scheduler rounds between retries of parked threads
+#define GT_MAXNAP 4    // longest sleep, in ticks, of a carrier with no work
+
+enum gtstate { GT_RUNNABLE, GT_PARKED, GT_EXITED };
+
+// Saved registers of a green thread, as pushed by gtswtch.S.
+struct gtcontext {
+  uint edi;
+  uint esi;
+  uint ebx;
+  uint ebp;
+  uint eip;
+};
+
+struct gthread {
+  struct gtcontext *context;  // gtswtch() here to run the thread
+  enum gtstate state;         // why it last switched to its carrier
+  void (*fn)(void*);
+  void *arg;
+  struct carrier *carrier;    // carrier running this thread
+  struct gthread *next;       // in run queue, parked list or free list
+};
+
+struct gtqueue {
+  volatile uint lock;
+  struct gthread *head;
+  struct gthread *tail;
+};
+
+struct carrier {
+  struct gtqueue runq;
+  struct gthread *parked;     // waiting for I/O; only this carrier uses it
+  struct gtcontext *scheduler;
+  thread_t thread;
+  uint seed;                  // to choose victim when stealing
+  int nap;                    // ticks to sleep when idle; 0 after progress
+};
+
+void gtswtch(struct gtcontext**, struct gtcontext*);
+
+static struct {
+  int ncarriers;
+  struct carrier carriers[GT_MAXCARRIERS];
+  int running;                // inside gt_run()
+  volatile uint live;         // green threads that have not exited
+  volatile uint lock;         // protects free and chunks
+  struct gthread *free;       // stacks of exited green threads
+  char *chunks;               // malloc'd blocks of stacks
+} gt;
+
+static void
+lock(volatile uint *l)
+{
+  while(xchg(l, 1) != 0)
+    ;
+}
+
+static void
+unlock(volatile uint *l)
+{
+  xchg(l, 0);
+}
+
+static void
+addlive(int n)
+{
+  uint old;
+
+  do
+    old = gt.live;
+  while(cmpxchg(&gt.live, old, old + n) != old);
+}
+
+static void
+enqueue(struct gtqueue *q, struct gthread *g)
+{
+  g->next = 0;
+  lock(&q->lock);
+  if(q->tail)
+    q->tail->next = g;
+  else
+    q->head = g;
+  q->tail = g;
+  unlock(&q->lock);
+}
+
+static struct gthread*
+dequeue(struct gtqueue *q)
+{
+  struct gthread *g;
+
+  if(q->head == 0)
+    return 0;
+  lock(&q->lock);
+  if((g = q->head) != 0){
+    q->head = g->next;
+    if(q->head == 0)
+      q->tail = 0;
+  }
+  unlock(&q->lock);
+  return g;
+}
+
+// The green thread running on this stack.
+static struct gthread*
+self(void)
+{
+  uint esp;
+
+  asm volatile("movl %%esp, %0" : "=r" (esp));
+  return (struct gthread*)(esp & ~(GT_STACKSIZE - 1));
+}
+
+static struct gthread*
+stackalloc(void)
+{
+  struct gthread *g;
+  char *chunk;
+  uint a;
+  int i;
+
+  lock(&gt.lock);
+  if(gt.free == 0){
+    // The first word links the chunks to free them in gt_run().
+    if((chunk = malloc((GT_CHUNK + 1) * GT_STACKSIZE)) == 0){
+      unlock(&gt.lock);
+      return 0;
+    }
+    *(char**)chunk = gt.chunks;
+    gt.chunks = chunk;
+    a = ((uint)chunk + sizeof(char*) + GT_STACKSIZE - 1) & ~(GT_STACKSIZE - 1);
+    for(i = 0; i < GT_CHUNK; i++, a += GT_STACKSIZE){
+      g = (struct gthread*)a;
+      g->next = gt.free;
+      gt.free = g;
+    }
+  }
+  g = gt.free;
+  gt.free = g->next;
+  unlock(&gt.lock);
+  return g;
+}
+
+static void
+stackfree(struct gthread *g)
+{
+  lock(&gt.lock);
+  g->next = gt.free;
+  gt.free = g;
+  unlock(&gt.lock);
+}
+
+// Switch from the running green thread to its carrier.
+static void
+sched(enum gtstate state)
+{
+  struct gthread *g = self();
+
+  g->state = state;
+  gtswtch(&g->context, g->carrier->scheduler);
+}
+
+// A new green thread starts here.
+static void
+gtentry(void)
+{
+  struct gthread *g = self();
+
+  g->fn(g->arg);
+  gt_exit();
+}
+
+static struct gthread*
+steal(struct carrier *c)
+{
+  struct gthread *g;
+  int i, victim;
+
+  for(i = 0; i < gt.ncarriers; i++){
+    c->seed = c->seed * 1103515245 + 12345;
+    victim = (c->seed >> 16) % gt.ncarriers;
+    if(&gt.carriers[victim] == c)
+      continue;
+    if((g = dequeue(&gt.carriers[victim].runq)) != 0)
+      return g;
+  }
+  return 0;
+}
+
+// Put the parked threads of c back on its run queue,
+// to retry their I/O.
+static void
+unpark(struct carrier *c)
+{
+  struct gthread *g;
+
+  while((g = c->parked) != 0){
+    c->parked = g->next;
+    enqueue(&c->runq, g);
+  }
+}
+
+// Run green threads until all of them have exited.
+// Parked threads retry every GT_REPOLL rounds, so that
+// a carrier that always has work does not starve them.
+// A carrier that has had nothing to run for GT_SPINS rounds
+// blocks in sleep(), for twice as long each time up to
+// GT_MAXNAP ticks, and then lets its parked threads retry.
+// A thread that parks again without any I/O getting through
+// is no progress, so the carrier keeps backing off.
+static void
+schedule(struct carrier *c)
+{
+  struct gthread *g;
+  int idle, n;
+
+  idle = 0;
+  n = 0;
+  while(gt.live > 0){
+    if(c->parked && ++n >= GT_REPOLL){
+      unpark(c);
+      n = 0;
+    }
+    if((g = dequeue(&c->runq)) == 0 && (g = steal(c)) == 0){
+      if(++idle < GT_SPINS)
+        continue;
+      idle = 0;
+      if(c->nap == 0){
+        yield();
+        c->nap = 1;
+      } else {
+        sleep(c->nap);
+        if(c->nap < GT_MAXNAP)
+          c->nap *= 2;
+      }
+      unpark(c);
+      n = 0;
+      continue;
+    }
+
+    g->carrier = c;
+    gtswtch(&c->scheduler, g->context);
+
+    switch(g->state){
+    case GT_RUNNABLE:
+      enqueue(&c->runq, g);
+      idle = c->nap = 0;
+      break;
+    case GT_PARKED:
+      g->next = c->parked;
+      c->parked = g;
+      break;
+    case GT_EXITED:
+      stackfree(g);
+      addlive(-1);
+      idle = c->nap = 0;
+      break;
+    }
+  }
+}
+
+static void*
+carrierstart(void *arg)
+{
+  schedule(arg);
+  thread_exit(0);
+}
+
+// Create a green thread running fn(arg).
+// Returns 0 on success, -1 on failure.
+int
+gt_create(void (*fn)(void*), void *arg)
+{
+  struct gthread *g;
+  struct carrier *c;
+  uint *sp;
+
+  if((g = stackalloc()) == 0)
+    return -1;
+  g->fn = fn;
+  g->arg = arg;
+  g->state = GT_RUNNABLE;
+
+  // Set up new context to start executing at gtentry,
+  // with a fake return PC above it.
+  sp = (uint*)((char*)g + GT_STACKSIZE);
+  *--sp = 0;
+  sp -= sizeof(struct gtcontext) / sizeof(uint);
+  g->context = (struct gtcontext*)sp;
+  memset(g->context, 0, sizeof(*g->context));
+  g->context->eip = (uint)gtentry;
+
+  // Count it before anyone can run it and exit.
+  addlive(1);
+  c = gt.running ? self()->carrier : &gt.carriers[0];
+  enqueue(&c->runq, g);
+  return 0;
+}
+
+// Run all green threads on ncarriers LWPs, the caller being one
+// of them, and return when all green threads have exited.
+// Returns 0 on success, -1 on failure.
+int
+gt_run(int ncarriers)
+{
+  void *retval;
+  char *chunk;
+  int i, n;
+
+  if(ncarriers < 1 || ncarriers > GT_MAXCARRIERS || gt.running)
+    return -1;
+
+  for(i = 0; i < ncarriers; i++){
+    gt.carriers[i].parked = 0;
+    gt.carriers[i].nap = 0;
+    gt.carriers[i].seed = i + 1;
+  }
+  gt.ncarriers = ncarriers;
+  gt.running = 1;
+
+  // Carriers that fail to start have nothing on their
+  // run queues, so the others simply do their share.
+  for(n = 1; n < ncarriers; n++)
+    if(thread_create(&gt.carriers[n].thread, carrierstart, &gt.carriers[n]) != 0)
+      break;
+  schedule(&gt.carriers[0]);
+  for(i = 1; i < n; i++)
+    thread_join(gt.carriers[i].thread, &retval);
+  gt.running = 0;
+
+  while((chunk = gt.chunks) != 0){
+    gt.chunks = *(char**)chunk;
+    free(chunk);
+  }
+  gt.free = 0;
+  return 0;
+}
+
+// Let other green threads run.
+void
+gt_yield(void)
+{
+  if(gt.running)
+    sched(GT_RUNNABLE);
+}
+
+// Terminate the calling green thread.
+void
+gt_exit(void)
+{
+  if(gt.running)
+    sched(GT_EXITED);
+  exit();
+}
+
+// Read from fd. If fd is an O_NONBLOCK pipe with no data,
+// park the green thread until there is some.
+int
+gt_read(int fd, void *buf, int n)
+{
+  int r;
+
+  while((r = read(fd, buf, n)) == EWOULDBLOCK && gt.running)
+    sched(GT_PARKED);
+  if(gt.running)
+    self()->carrier->nap = 0;
+  return r;
+}
+
+// Write n bytes to fd. If fd is an O_NONBLOCK pipe that fills up,
+// park the green thread until there is room for the rest.
+int
+gt_write(int fd, void *buf, int n)
+{
+  int r, i;
+
+  for(i = 0; i < n; i += r){
+    r = write(fd, (char*)buf + i, n - i);
+    if(r == EWOULDBLOCK && gt.running){
+      sched(GT_PARKED);
+      r = 0;
+    } else if(r < 0)
+      return i > 0 ? i : r;
+    else if(gt.running)
+      self()->carrier->nap = 0;
+  }
+  return n;
+}
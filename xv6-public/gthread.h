@@ -0,0 +1,21 @@
+// M:N green threads on top of thread_create().
+//
+// Green threads are scheduled cooperatively by a few LWP
+// "carriers", each with its own run queue; idle carriers steal
+// from the others. A green thread runs until it calls gt_yield(),
+// gt_exit() or returns from its function.
+//
+// gt_read() and gt_write() on an O_NONBLOCK pipe park the
+// calling green thread, not its carrier, until the pipe is ready.
+//
+// gt_create() may be called before gt_run() or from green threads.
+
+#define GT_MAXCARRIERS  8
+#define GT_STACKSIZE    8192   // stack of each green thread (power of 2)
+
+int  gt_create(void (*fn)(void*), void *arg);
+int  gt_run(int ncarriers);
+void gt_yield(void);
+void gt_exit(void) __attribute__((noreturn));
+int  gt_read(int fd, void *buf, int n);
+int  gt_write(int fd, void *buf, int n);
@@ -0,0 +1,172 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "fcntl.h"
+#include "gthread.h"
+
+// Test and benchmark of green threads.
+// usage: gthreadtest [ncarriers]
+
+#define NGREEN     2000
+#define NYIELD     10
+#define NMSG       2000
+#define NPRODUCER  4
+
+volatile uint counter;
+int fds[2];
+
+void
+inc(volatile uint *p)
+{
+  uint old;
+
+  do
+    old = *p;
+  while(cmpxchg(p, old, old + 1) != old);
+}
+
+void
+yielder(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NYIELD; i++){
+    inc(&counter);
+    gt_yield();
+  }
+}
+
+void
+spawner(void *arg)
+{
+  // Green threads may create green threads.
+  if(gt_create(yielder, 0) < 0)
+    printf(1, "panic at gt_create (nested)\n");
+}
+
+void
+test1(int ncarriers)
+{
+  int i, start, ticks;
+
+  counter = 0;
+  for(i = 0; i < NGREEN; i++){
+    if(gt_create(i % 10 ? yielder : spawner, 0) < 0){
+      printf(1, "panic at gt_create\n");
+      return;
+    }
+  }
+  start = uptime();
+  if(gt_run(ncarriers) < 0){
+    printf(1, "panic at gt_run\n");
+    return;
+  }
+  ticks = uptime() - start;
+
+  // Every tenth green thread spawns one more yielder.
+  if(counter != NGREEN * NYIELD){
+    printf(1, "panic at test1: counter %d\n", counter);
+    return;
+  }
+  printf(1, "%d green threads, %d yields in %d ticks\n",
+         NGREEN + NGREEN / 10, counter, ticks);
+  printf(1, "Test 1 is done!\n");
+}
+
+void
+producer(void *arg)
+{
+  int i, v;
+
+  for(i = 0; i < NMSG; i++){
+    v = (int)arg;
+    if(gt_write(fds[1], &v, sizeof(v)) != sizeof(v)){
+      printf(1, "panic at gt_write\n");
+      return;
+    }
+  }
+}
+
+void
+consumer(void *arg)
+{
+  int i, v, n, sum;
+
+  sum = 0;
+  for(i = 0; i < NMSG * NPRODUCER; i++){
+    // Pipes move whole ints here, because every write
+    // is 4 bytes and the pipe size is a multiple of 4.
+    if((n = gt_read(fds[0], &v, sizeof(v))) != sizeof(v)){
+      printf(1, "panic at gt_read: %d\n", n);
+      return;
+    }
+    sum += v;
+  }
+  *(int*)arg = sum;
+}
+
+void
+test2(int ncarriers)
+{
+  int i, sum, expected;
+
+  if(pipe(fds) < 0){
+    printf(1, "panic at pipe\n");
+    return;
+  }
+  if(fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+     fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0 ||
+     (fcntl(fds[0], F_GETFL, 0) & O_NONBLOCK) == 0){
+    printf(1, "panic at fcntl\n");
+    return;
+  }
+  if(read(fds[0], &i, sizeof(i)) != EWOULDBLOCK){
+    printf(1, "panic at nonblocking read\n");
+    return;
+  }
+
+  // The consumer is created first, so that it parks on the
+  // empty pipe while its carrier keeps running the others.
+  sum = -1;
+  expected = 0;
+  gt_create(consumer, &sum);
+  for(i = 0; i < NPRODUCER; i++){
+    gt_create(producer, (void*)(i + 1));
+    expected += (i + 1) * NMSG;
+  }
+  for(i = 0; i < 100; i++)
+    gt_create(yielder, 0);
+  gt_run(ncarriers);
+  close(fds[0]);
+  close(fds[1]);
+
+  if(sum != expected){
+    printf(1, "panic at test2: sum %d, expected %d\n", sum, expected);
+    return;
+  }
+  printf(1, "Test 2 is done!\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ncarriers;
+
+  ncarriers = 4;
+  if(argc > 1)
+    ncarriers = atoi(argv[1]);
+  if(ncarriers < 1 || ncarriers > GT_MAXCARRIERS){
+    printf(2, "usage: gthreadtest [1-%d]\n", GT_MAXCARRIERS);
+    exit();
+  }
+
+  printf(1, "===========Test1===========\n");
+  test1(ncarriers);
+
+  printf(1, "===========Test2===========\n");
+  test2(ncarriers);
+
+  printf(1, "All tests are done\n");
+  exit();
+}
@@ -1,28 +1,87 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers.
+//
+// Free memory is kept by a binary buddy allocator, in blocks of
+// 2^order pages for order 0 to KMAXORDER, so that physically
+// contiguous blocks (e.g. 4MB superpages) can be allocated with
+// kalloc_order(). A freed block is merged with its buddy, the
+// other half of the block twice its size, whenever that is free.
+// Single pages, by far the most common, go through per-CPU
+// magazines in front of the buddy allocator.
+//
+// CPUs with nothing to run zero free pages ahead of time, for
+// kalloc_zeroed(), so that page faults, fork and page table
+// allocation do not have to zero pages themselves.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "memstat.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define KBATCH     32   // pages moved between a magazine and kmem at once
+#define KCACHEMAX  64   // most pages kept in one CPU's magazine
+#define FREEBLK    0x80 // in kmem.order[]: first page of a free block
+#define KZEROMAX   256  // most pages kept zeroed
+#define KZEROBATCH 8    // pages zeroed per idle round
+
+#define NPAGE      (PHYSTOP/PGSIZE)
+
 struct run {
   struct run *next;
+  struct run *prev;       // only on the buddy free lists
 };
 
 struct {
-  struct spinlock lock;
+  struct spinlock lock;   // protects free, nfree, order and the counts
   int use_lock;
-  struct run *freelist;
+  uint npages;            // pages given to the allocator
+  uint nalloc;            // pages allocated with kalloc_order(), or while booting
+  uint nfreed;            // pages freed with kfree_order()
+  struct run *free[KMAXORDER+1];  // free blocks of each order
+  int nfree[KMAXORDER+1];
+  // For the first page of each free block, its order | FREEBLK.
+  uchar order[NPAGE];
+  // Number of page tables and kernel users referring to each
+  // physical page (or block, in its first page), so that pages
+  // can be shared copy-on-write.
+  volatile int ref[NPAGE];
 } kmem;
 
+// Per-CPU magazines of free pages. kalloc() and kfree() work on
+// the local magazine, and move KBATCH pages at a time to or from
+// the buddy allocator, so most calls take no lock that other CPUs
+// use. A magazine has its own lock only so that a CPU that has run
+// out of memory can take pages from the others.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;                  // number of pages on freelist
+  uint nalloc;            // pages allocated from this magazine
+  uint nfree;             // pages freed to it
+} kcache[NCPU];
+
+// Pages zeroed by idle CPUs, for kalloc_zeroed(). They count as
+// allocated, with one reference, while they are here.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+// End of the physical memory the kernel uses: the memory the
+// BIOS reports, up to PHYSTOP, in whole 4MB superpages.
+uint physend;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,8 +90,17 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   kmem.use_lock = 0;
+  physend = cmosmemsize();
+  if(physend > PHYSTOP || physend < EXTMEM)
+    physend = PHYSTOP;
+  physend &= ~(SUPERPGSIZE - 1);
   freerange(vstart, vend);
 }
 
@@ -48,32 +116,226 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p) / PGSIZE] = 1;
     kfree(p);
+    kmem.npages++;
+  }
+}
+
+static struct run*
+blockat(uint pfn)
+{
+  return (struct run*)P2V(pfn * PGSIZE);
+}
+
+static void
+pushfree(uint pfn, int order)
+{
+  struct run *r;
+
+  r = blockat(pfn);
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  kmem.order[pfn] = FREEBLK | order;
+}
+
+static void
+unlinkfree(uint pfn, int order)
+{
+  struct run *r;
+
+  r = blockat(pfn);
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  kmem.order[pfn] = 0;
+}
+
+// Take a block of 2^order pages, splitting a larger one if
+// needed. Returns 0 if there is none.
+// Caller holds kmem.lock, unless still booting.
+static char*
+buddyalloc(int order)
+{
+  uint pfn;
+  int o;
+
+  for(o = order; o <= KMAXORDER && kmem.free[o] == 0; o++)
+    ;
+  if(o > KMAXORDER)
+    return 0;
+  pfn = V2P(kmem.free[o]) / PGSIZE;
+  unlinkfree(pfn, o);
+  // Give back the upper halves.
+  while(o > order){
+    o--;
+    pushfree(pfn + (1 << o), o);
+  }
+  return (char*)blockat(pfn);
+}
+
+// Return block v of 2^order pages, merging it with its buddy
+// for as long as the buddy is free too.
+// Caller holds kmem.lock, unless still booting.
+static void
+buddyfree(char *v, int order)
+{
+  uint pfn, buddy;
+
+  pfn = V2P(v) / PGSIZE;
+  while(order < KMAXORDER){
+    buddy = pfn ^ (1 << order);
+    if(buddy >= NPAGE || kmem.order[buddy] != (FREEBLK | order))
+      break;
+    unlinkfree(buddy, order);
+    pfn &= ~(1 << order);
+    order++;
+  }
+  pushfree(pfn, order);
+}
+
+// Move up to KBATCH pages from the buddy allocator to kc.
+// Caller holds kc->lock.
+static void
+refill(struct kcache *kc)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = (struct run*)buddyalloc(0)) != 0; i++){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from kc back to the buddy allocator.
+// Caller holds kc->lock.
+static void
+drain(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  for(; n > 0; n--){
+    r = kc->freelist;
+    kc->freelist = r->next;
+    kc->n--;
+    buddyfree((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// The buddy allocator is out of pages:
+// take a page from some other CPU's magazine.
+static struct run*
+steal(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < ncpu; i++){
+    acquire(&kcache[i].lock);
+    if((r = kcache[i].freelist) != 0){
+      kcache[i].freelist = r->next;
+      kcache[i].n--;
+      kcache[i].nalloc++;
+    }
+    release(&kcache[i].lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Take a page from the zeroed pool, or return 0.
+static struct run*
+zeroget(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if((r = kzero.list) != 0){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
 }
+
+// Add a reference to the page at v, e.g. when a page
+// table starts sharing it.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  xadd(&kmem.ref[V2P(v) / PGSIZE], 1);
+}
+
+// Number of references to the page at v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed at
+// by v, and free it if that was the last one. v normally
+// should have been returned by a call to kalloc().
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
+  int ref;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if((ref = xadd(&kmem.ref[V2P(v) / PGSIZE], -1)) > 1)
+    return;
+  if(ref != 1)
+    panic("kfree: ref");
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
+
+  if(!kmem.use_lock){
+    // Still booting on one CPU.
+    buddyfree(v, 0);
+    return;
+  }
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pushcli();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(++kc->n > KCACHEMAX)
+    drain(kc, KBATCH);
+  release(&kc->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +345,180 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    if((r = (struct run*)buddyalloc(0)) != 0){
+      kmem.ref[V2P(r) / PGSIZE] = 1;
+      kmem.nalloc++;
+    }
+    return (char*)r;
+  }
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  if(kc->freelist == 0)
+    refill(kc);
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->n--;
+    kc->nalloc++;
+  }
+  release(&kc->lock);
+  popcli();
+
+  if(r == 0)
+    r = steal();
+  if(r == 0)
+    r = zeroget();    // already counted as allocated
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    kmem.ref[V2P(r) / PGSIZE] = 1;
   return (char*)r;
 }
 
+// Allocate one page of physical memory, filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  char *v;
+
+  if(kmem.use_lock && (v = (char*)zeroget()) != 0)
+    return v;
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero a few free pages for kalloc_zeroed(). Called by the
+// scheduler when this CPU has nothing to run.
+void
+kzerofill(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < KZEROBATCH && kzero.n < KZEROMAX; i++){
+    if((r = (struct run*)kalloc()) == 0)
+      return;
+    pagezero(r);
+    acquire(&kzero.lock);
+    r->next = kzero.list;
+    kzero.list = r;
+    kzero.n++;
+    release(&kzero.lock);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to their
+// size. Their references are counted in the first page (see kref).
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_order(int order)
+{
+  char *v;
+  int i;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > KMAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  if((v = buddyalloc(order)) != 0)
+    kmem.nalloc += 1 << order;
+  release(&kmem.lock);
+  if(v == 0){
+    // Pages in the magazines keep their buddies from merging:
+    // return them all and try again.
+    for(i = 0; i < ncpu; i++){
+      acquire(&kcache[i].lock);
+      drain(&kcache[i], kcache[i].n);
+      release(&kcache[i].lock);
+    }
+    acquire(&kmem.lock);
+    if((v = buddyalloc(order)) != 0)
+      kmem.nalloc += 1 << order;
+    release(&kmem.lock);
+  }
+  if(v)
+    kmem.ref[V2P(v) / PGSIZE] = 1;
+  return v;
+}
+
+// Drop a reference to block v of 2^order pages, allocated by
+// kalloc_order(), and free it if that was the last one.
+void
+kfree_order(char *v, int order)
+{
+  int ref;
+
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > KMAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) >= PHYSTOP)
+    panic("kfree_order");
+
+  if((ref = xadd(&kmem.ref[V2P(v) / PGSIZE], -1)) > 1)
+    return;
+  if(ref != 1)
+    panic("kfree_order: ref");
+
+  acquire(&kmem.lock);
+  buddyfree(v, order);
+  kmem.nfreed += 1 << order;
+  release(&kmem.lock);
+}
+
+// Fill in the page counts of ms. Pages move between the
+// magazines and the buddy allocator meanwhile, so the counts
+// are a close estimate.
+void
+kallocstat(struct memstat *ms)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  ms->total = kmem.npages;
+  ms->free = 0;
+  for(i = 0; i <= KMAXORDER; i++)
+    ms->free += kmem.nfree[i] << i;
+  ms->nalloc = kmem.nalloc;
+  ms->nfree = kmem.nfreed;
+  release(&kmem.lock);
+  for(i = 0; i < ncpu; i++){
+    acquire(&kcache[i].lock);
+    ms->free += kcache[i].n;
+    ms->nalloc += kcache[i].nalloc;
+    ms->nfree += kcache[i].nfree;
+    release(&kcache[i].lock);
+  }
+  ms->zeroed = kzero.n;
+}
+
+// Print the free blocks of each order, to see how fragmented
+// free memory is. For debugging; runs on ^P with procdump().
+// No lock to avoid wedging a stuck machine further.
+void
+kallocdump(void)
+{
+  int i, n, free;
+
+  free = 0;
+  cprintf("memory: %dMB\n", physend / (1024*1024));
+  cprintf("free blocks by order:");
+  for(i = 0; i <= KMAXORDER; i++){
+    cprintf(" %d", kmem.nfree[i]);
+    free += kmem.nfree[i] << i;
+  }
+  n = 0;
+  for(i = 0; i < ncpu; i++)
+    n += kcache[i].n;
+  // Percentage of free pages that are not in a block
+  // big enough for a superpage.
+  cprintf("\nfree pages: %d (+%d in magazines, %d zeroed), %d%% fragmented\n",
+          free, n, kzero.n, free ? 100 - (kmem.nfree[KMAXORDER] << KMAXORDER) * 100 / free : 0);
+}
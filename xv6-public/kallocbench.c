@@ -0,0 +1,84 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Benchmark of the kernel page allocator.
+// 1..N processes run at once, each growing and shrinking its
+// memory with sbrk() and forking short-lived children, which
+// allocates and frees many pages. Reports total time in ticks
+// and page allocation throughput relative to one process.
+// Run it under e.g. `make qemu CPUS=4`.
+//
+// usage: kallocbench [maxprocs]
+
+#define MAXPROCS  8
+#define ROUNDS    200
+#define NPAGES    64
+#define NFORK     20
+
+void
+work(void)
+{
+  int i;
+  char *p;
+
+  for(i = 0; i < ROUNDS; i++){
+    if((p = sbrk(NPAGES * 4096)) == (char*)-1){
+      printf(2, "kallocbench: sbrk failed\n");
+      exit();
+    }
+    sbrk(-NPAGES * 4096);
+  }
+  for(i = 0; i < NFORK; i++){
+    if(fork() == 0)
+      exit();
+    wait();
+  }
+}
+
+// Print x/100 as a fixed-point number.
+void
+printfix(int x)
+{
+  printf(1, "%d.%d%d", x / 100, (x / 10) % 10, x % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxprocs, n, i, ticks, base;
+  uint start;
+
+  maxprocs = 4;
+  if(argc > 1)
+    maxprocs = atoi(argv[1]);
+  if(maxprocs < 1 || maxprocs > MAXPROCS){
+    printf(2, "usage: kallocbench [1-%d]\n", MAXPROCS);
+    exit();
+  }
+
+  printf(1, "procs\tticks\tthroughput\n");
+  base = 1;
+  for(n = 1; n <= maxprocs; n++){
+    start = uptime();
+    for(i = 0; i < n; i++){
+      if(fork() == 0){
+        work();
+        exit();
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    ticks = uptime() - start;
+    if(ticks == 0)
+      ticks = 1;
+    if(n == 1)
+      base = ticks;
+
+    // n times the work of one process in ticks.
+    printf(1, "%d\t%d\t", n, ticks);
+    printfix(n * base * 100 / ticks);
+    printf(1, "\n");
+  }
+  exit();
+}
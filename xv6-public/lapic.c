@@ -113,6 +113,19 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send a fixed interrupt with the given vector to the CPU
+// with the given APIC ID.
+void
+lapicipi(uchar apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -164,6 +177,9 @@ lapicstartap(uchar apicid, uint addr)
 #define CMOS_STATB   0x0b
 #define CMOS_UIP    (1 << 7)        // RTC update in progress
 
+#define MEMLO   0x30  // extended memory above 1MB, in KB
+#define MEMHI   0x34  // extended memory above 16MB, in 64KB
+
 #define SECS    0x00
 #define MINS    0x02
 #define HOURS   0x04
@@ -179,6 +195,19 @@ static uint cmos_read(uint reg)
   return inb(CMOS_RETURN);
 }
 
+// Size of physical memory in bytes, as found by the BIOS.
+uint
+cmosmemsize(void)
+{
+  uint n;
+
+  n = cmos_read(MEMHI) | cmos_read(MEMHI+1) << 8;
+  if(n > 0)
+    return 16*1024*1024 + n*64*1024;
+  n = cmos_read(MEMLO) | cmos_read(MEMLO+1) << 8;
+  return EXTMEM + n*1024;
+}
+
 static void fill_rtcdate(struct rtcdate *r)
 {
   r->second = cmos_read(SECS);
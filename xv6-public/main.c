@@ -19,6 +19,7 @@ main(void)
 {
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
+  sseinit();       // SSE for page copies
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
   seginit();       // segment descriptors
@@ -26,13 +27,18 @@ main(void)
   ioapicinit();    // another interrupt controller
   consoleinit();   // console hardware
   uartinit();      // serial port
+  kminit();        // slab allocator
   pinit();         // process table
+  vminit();        // address spaces
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipes
+  shminit();       // shared-memory segments
+  textinit();      // text cache
   ideinit();       // disk 
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(physend)); // must come after startothers()
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -42,6 +48,7 @@ static void
 mpenter(void)
 {
   switchkvm();
+  sseinit();
   seginit();
   lapicinit();
   mpmain();
@@ -0,0 +1,230 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// Benchmark of malloc() and free() against the K&R first-fit
+// allocator that umalloc.c used to be, made thread-safe with one
+// lock. Each thread keeps NSLOT blocks of random sizes and
+// replaces a random one NOPS times, with one thread and then
+// with several.
+//
+// usage: mallocbench [nthreads]
+
+#define NSLOT     128
+#define NOPS      20000
+#define MAXSIZE   512
+#define MAXTHR    16
+
+struct allocator {
+  char *name;
+  void* (*alloc)(uint);
+  void (*free)(void*);
+};
+
+// The old allocator, from Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+static volatile uint krlocked;
+
+static void
+krlock(void)
+{
+  while(xchg(&krlocked, 1) != 0)
+    yield();
+}
+
+static void
+krunlock(void)
+{
+  xchg(&krlocked, 0);
+}
+
+static void
+krfree1(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+void
+krfree(void *ap)
+{
+  krlock();
+  krfree1(ap);
+  krunlock();
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree1((void*)(hp + 1));
+  return freep;
+}
+
+void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  krlock();
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      krunlock();
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0){
+        krunlock();
+        return 0;
+      }
+  }
+}
+
+struct allocator allocators[] = {
+  { "K&R", krmalloc, krfree },
+  { "malloc", malloc, free },
+};
+
+struct allocator *cur;
+void *slots[MAXTHR][NSLOT];
+volatile int failed;
+
+uint
+rand(uint *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+void*
+worker(void *arg)
+{
+  int id, i, j;
+  uint seed, n;
+  void **s;
+
+  id = (int)arg;
+  s = slots[id];
+  seed = id + 1;
+  for(i = 0; i < NOPS; i++){
+    j = rand(&seed) % NSLOT;
+    if(s[j])
+      cur->free(s[j]);
+    // Mostly small blocks, as programs use them.
+    n = rand(&seed) % MAXSIZE;
+    if(rand(&seed) % 4)
+      n %= 64;
+    if((s[j] = cur->alloc(n + 1)) == 0){
+      failed = 1;
+      break;
+    }
+    *(char*)s[j] = i;
+  }
+  for(j = 0; j < NSLOT; j++){
+    if(s[j])
+      cur->free(s[j]);
+    s[j] = 0;
+  }
+  return 0;
+}
+
+int
+run(int nthr)
+{
+  thread_t t[MAXTHR];
+  void *ret;
+  int i, start;
+
+  start = uptime();
+  for(i = 1; i < nthr; i++){
+    if(thread_create(&t[i], worker, (void*)i) != 0){
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  worker((void*)0);
+  for(i = 1; i < nthr; i++)
+    thread_join(t[i], &ret);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, nthr, t1, tn;
+
+  nthr = 4;
+  if(argc > 1)
+    nthr = atoi(argv[1]);
+  if(nthr < 1 || nthr > MAXTHR){
+    printf(2, "usage: mallocbench [1-%d]\n", MAXTHR);
+    exit();
+  }
+
+  for(i = 0; i < sizeof(allocators)/sizeof(allocators[0]); i++){
+    cur = &allocators[i];
+    t1 = run(1);
+    tn = run(nthr);
+    if(failed){
+      printf(1, "panic at %s: out of memory\n", cur->name);
+      exit();
+    }
+    printf(1, "%s: %d ops in %d ticks with 1 thread, %d ops in %d ticks with %d threads\n",
+           cur->name, NOPS, t1, nthr*NOPS, tn, nthr);
+  }
+  exit();
+}
@@ -0,0 +1,29 @@
+// Memory statistics, from memstat() and procmem().
+// Sizes are in pages.
+
+// The whole machine.
+struct memstat {
+  uint total;       // physical memory managed by kalloc()
+  uint free;        // free pages
+  uint zeroed;      // pages zeroed ahead of time, not counted in free
+  uint nalloc;      // pages allocated since boot; wraps around
+  uint nfree;       // pages freed since boot; wraps around
+  uint swaptotal;   // slots in the swap area
+  uint swapused;
+  uint text;        // pages in the text cache
+  uint nbuf;        // blocks in the buffer cache
+  uint bufvalid;    // blocks holding data from the disk
+  uint bufbusy;     // blocks in use
+};
+
+// One process, with all its threads.
+struct procmem {
+  int pid;
+  char name[16];
+  uint size;        // sz, including memory not yet touched
+  uint rss;         // resident user pages, shared ones included
+  uint swapped;     // user pages on swap
+  uint ptpages;     // page directory and page table pages
+  int nthread;
+  int idlestacks;   // stacks of exited threads kept for new ones
+};
@@ -0,0 +1,12 @@
+// mmap() protections
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+// mmap() flags
+#define MAP_SHARED  0x1   // writes go to the file and to forked children
+#define MAP_PRIVATE 0x2   // writes stay private to the process
+#define MAP_ANON    0x4   // zeroed memory, not backed by a file
+#define MAP_HUGE    0x8   // 4MB pages; only with MAP_SHARED|MAP_ANON
+
+// Returned by mmap() on failure.
+#define MAP_FAILED  ((void*)-1)
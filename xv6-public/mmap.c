@@ -0,0 +1,418 @@
+// Memory-mapped files and anonymous memory.
+//
+// mmap() only records a region in the address space's vma
+// table; pagefault() fills its pages on first touch, reading
+// file-backed pages from the inode through the buffer cache.
+// exec() maps the segments of a program the same way, as
+// private regions below sz (see mmapexec()).
+// Dirty pages of MAP_SHARED file regions are written back
+// through the log by msync(), munmap() and exit/exec, using
+// the dirty bits of their PTEs. Shared-memory segments (shm.c)
+// are attached as MAP_SHARED regions backed by the segment's pages.
+//
+// Pages of MAP_SHARED regions are shared with forked children,
+// so related processes see each other's writes at once. There
+// is no page cache shared by unrelated processes: they see each
+// other's writes to a file only after writeback.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "vm.h"
+#include "mman.h"
+
+#define WBBATCH  16  // pages written back per pass over the page table
+
+// Return the region of vm containing va, or 0.
+// Caller must hold vm->lock.
+struct vma*
+mmapfind(struct vm *vm, uint va)
+{
+  struct vma *v;
+
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the lowest region of vm above va, or 0.
+// Caller must hold vm->lock.
+static struct vma*
+mmapnext(struct vm *vm, uint va)
+{
+  struct vma *v, *next;
+
+  next = 0;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+    if(v->end && v->start > va && (next == 0 || v->start < next->start))
+      next = v;
+  return next;
+}
+
+// Find a free region slot of vm and the lowest free range of
+// len bytes (page-aligned) at a multiple of align for it. Returns the slot with start
+// and end set, or 0 if there is none.
+// Caller must hold vm->lock.
+static struct vma*
+vmaalloc(struct vm *vm, uint len, uint align)
+{
+  struct vma *v, *w;
+  uint start;
+
+  if(len == 0 || len > KERNBASE - MMAPBASE)
+    return 0;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &vm->vma[NVMA])
+    return 0;
+
+  // First fit.
+  start = MMAPBASE;
+  for(;;){
+    start = (start + align - 1) & ~(align - 1);
+    if(start + len > KERNBASE || start + len < start)
+      return 0;
+    for(w = vm->vma; w < &vm->vma[NVMA]; w++)
+      if(w->end && w->start < start + len && start < w->end)
+        break;
+    if(w == &vm->vma[NVMA])
+      break;
+    start = w->end;
+  }
+  memset(v, 0, sizeof(*v));
+  v->start = start;
+  v->end = start + len;
+  return v;
+}
+
+// Map len bytes (page-aligned) of f from offset off, or zeroed
+// memory if f is 0, at the lowest free address of vm. MAP_HUGE
+// regions are rounded to 4MB superpages.
+// Returns the address, or -1 on failure.
+int
+mmap(struct vm *vm, uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v;
+  uint start, align;
+
+  align = PGSIZE;
+  if(flags & MAP_HUGE){
+    len = (len + SUPERPGSIZE - 1) & ~(SUPERPGSIZE - 1);
+    align = SUPERPGSIZE;
+  }
+  acquire(&vm->lock);
+  if((v = vmaalloc(vm, len, align)) == 0){
+    release(&vm->lock);
+    return -1;
+  }
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  v->flen = len;
+  start = v->start;
+  release(&vm->lock);
+  return start;
+}
+
+// Map len bytes of shared-memory segment s, writable, at the
+// lowest free address of vm. The caller has counted the region
+// in s. Returns the address, or -1 on failure.
+int
+mmapshm(struct vm *vm, struct shm *s, uint len)
+{
+  struct vma *v;
+  uint start;
+
+  acquire(&vm->lock);
+  if((v = vmaalloc(vm, len, PGSIZE)) == 0){
+    release(&vm->lock);
+    return -1;
+  }
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->shm = s;
+  start = v->start;
+  release(&vm->lock);
+  return start;
+}
+
+// Map the segment of a program at va with memsz bytes, of
+// which the first filesz come from f at offset off, into vm.
+// Returns 0, or -1 if there is no room.
+int
+mmapexec(struct vm *vm, uint va, uint memsz, struct file *f, uint off, uint filesz)
+{
+  struct vma *v, *w;
+  uint end;
+
+  end = PGROUNDUP(va + memsz);
+  acquire(&vm->lock);
+  for(w = vm->vma; w < &vm->vma[NVMA]; w++)
+    if(w->end && w->start < end && va < w->end)
+      goto bad;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &vm->vma[NVMA])
+    goto bad;
+  memset(v, 0, sizeof(*v));
+  v->start = va;
+  v->end = end;
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_PRIVATE;
+  v->f = filedup(f);
+  v->off = off;
+  v->flen = filesz;
+  release(&vm->lock);
+  return 0;
+
+bad:
+  release(&vm->lock);
+  return -1;
+}
+
+// Read n bytes of f at offset off into page mem. The rest of
+// the page, and the part past the end of the file, are left as
+// they are (zeroed).
+void
+mmapread(struct file *f, char *mem, uint off, uint n)
+{
+  ilock(f->ip);
+  readi(f->ip, mem, off, n);
+  iunlock(f->ip);
+}
+
+// Write page mem back to f at offset off, not extending the file.
+static void
+mmapwrite(struct file *f, char *mem, uint off)
+{
+  uint n;
+
+  ilock(f->ip);
+  n = f->ip->size;
+  iunlock(f->ip);
+  if(off >= n)
+    return;
+  if(n - off > PGSIZE)
+    n = off + PGSIZE;
+  pfilewrite(f, mem, n - off, off);
+}
+
+// Write the dirty pages of MAP_SHARED file regions of vm in
+// [start, end) back to their files. The dirty pages are taken
+// under vm->lock in batches, and written without it.
+void
+msync(struct vm *vm, uint start, uint end)
+{
+  struct vma *v;
+  struct file *f;
+  uint va, first, pa[WBBATCH], off[WBBATCH];
+  int i, n;
+
+  if(start < MMAPBASE)
+    start = MMAPBASE;
+  if(end > KERNBASE || end < start)
+    end = KERNBASE;
+  va = PGROUNDDOWN(start);
+  while(va < end){
+    acquire(&vm->lock);
+    f = 0;
+    n = 0;
+    first = va;
+    for(; va < end && n < WBBATCH; va += PGSIZE){
+      if((v = mmapfind(vm, va)) == 0){
+        if((v = mmapnext(vm, va)) == 0 || v->start >= end){
+          va = end;
+          break;
+        }
+        va = v->start;
+      }
+      if(v->f == 0 || (v->flags & MAP_SHARED) == 0){
+        va = v->end - PGSIZE;
+        continue;
+      }
+      // One file per batch.
+      if(f && v->f != f)
+        break;
+      if((pa[n] = takedirty(vm, va)) == 0)
+        continue;
+      if(f == 0)
+        f = filedup(v->f);
+      off[n++] = v->off + (va - v->start);
+    }
+    // Later writes must set PTE_D again.
+    if(n > 0)
+      tlbshootdown(vm, first, va);
+    release(&vm->lock);
+
+    for(i = 0; i < n; i++){
+      mmapwrite(f, P2V(pa[i]), off[i]);
+      kfree(P2V(pa[i]));
+    }
+    if(f)
+      fileclose(f);
+  }
+}
+
+// Drop the first n bytes of region v.
+static void
+vmatrim(struct vma *v, uint n)
+{
+  v->start += n;
+  v->off += n;
+  v->flen = v->flen > n ? v->flen - n : 0;
+}
+
+// Write back and unmap [start, end) of vm, which need not be
+// mapped. Regions partly inside it are trimmed or split.
+// Returns 0 on success, -1 on failure.
+static int
+unmap(struct vm *vm, uint start, uint end)
+{
+  struct vma *v, *w, gone[NVMA];
+  uint s, e;
+  int i, n;
+
+  msync(vm, start, end);
+
+  acquire(&vm->lock);
+  // Superpages cannot be unmapped in part.
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++){
+    if(v->end == 0 || (v->flags & MAP_HUGE) == 0 || v->end <= start || end <= v->start)
+      continue;
+    if((start > v->start && start % SUPERPGSIZE) || (end < v->end && end % SUPERPGSIZE)){
+      release(&vm->lock);
+      return -1;
+    }
+  }
+  // Find a free slot first, in case a region has to be split.
+  w = 0;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++){
+    if(v->end && v->start < start && end < v->end)
+      w = v;
+  }
+  if(w){
+    for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+      if(v->end == 0)
+        break;
+    if(v == &vm->vma[NVMA]){
+      release(&vm->lock);
+      return -1;
+    }
+    *v = *w;
+    vmatrim(v, end - w->start);
+    if(v->f)
+      filedup(v->f);
+    if(v->shm)
+      shmdup(v->shm);
+    w->end = start;
+    vmdealloc(vm, end, start);
+    release(&vm->lock);
+    return 0;
+  }
+
+  n = 0;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++){
+    if(v->end == 0 || v->end <= start || end <= v->start)
+      continue;
+    s = v->start > start ? v->start : start;
+    e = v->end < end ? v->end : end;
+    vmdealloc(vm, e, s);
+    if(s == v->start && e == v->end){
+      gone[n++] = *v;
+      memset(v, 0, sizeof(*v));
+    } else if(s == v->start)
+      vmatrim(v, e - v->start);
+    else
+      v->end = s;
+  }
+  release(&vm->lock);
+
+  for(i = 0; i < n; i++){
+    if(gone[i].f)
+      fileclose(gone[i].f);
+    if(gone[i].shm)
+      shmput(gone[i].shm);
+  }
+  return 0;
+}
+
+// Unmap [start, end) of the mmap() regions of vm.
+// Returns 0 on success, -1 on failure.
+int
+munmap(struct vm *vm, uint start, uint end)
+{
+  if(start % PGSIZE || start < MMAPBASE || end > KERNBASE || start >= end)
+    return -1;
+  return unmap(vm, start, end);
+}
+
+// Copy the regions of vm to new address space nvm, created by
+// fork(). The pages themselves are shared by copyuvm().
+// Caller must hold vm->lock.
+void
+mmapdup(struct vm *nvm, struct vm *vm)
+{
+  struct vma *v;
+
+  memmove(nvm->vma, vm->vma, sizeof(vm->vma));
+  for(v = nvm->vma; v < &nvm->vma[NVMA]; v++){
+    if(v->end && v->f)
+      filedup(v->f);
+    if(v->end && v->shm)
+      shmdup(v->shm);
+  }
+}
+
+// Write back and unmap all regions of vm, also the program's
+// segments, when the last process using it exits or execs.
+void
+mmapclose(struct vm *vm)
+{
+  unmap(vm, 0, KERNBASE);
+}
+
+// Check that [va, va+n) is memory of the current process that
+// the kernel may read, or write if write is set. Pages of mmap()
+// regions, and pages not yet allocated or out on swap, are brought
+// in now, so that the kernel does not fault on them while holding
+// a spinlock, or a sleeplock of the file that backs them.
+// Returns 0 if the range is fine, -1 if not.
+int
+checkuva(uint va, uint n, int write)
+{
+  struct vm *vm = myproc()->vm;
+  struct vma *v;
+  uint a;
+  int ok;
+
+  if(va + n < va)
+    return -1;
+  if(va < vm->sz && va + n <= vm->sz){
+    for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+      if(!uvmpresent(vm, a) && pagefault(a, write ? FEC_WR : 0) < 0)
+        return -1;
+    return 0;
+  }
+
+  acquire(&vm->lock);
+  ok = (v = mmapfind(vm, va)) != 0 && va + n <= v->end &&
+       (!write || (v->prot & PROT_WRITE));
+  release(&vm->lock);
+  if(!ok)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(pagefault(a, write ? FEC_WR : 0) < 0)
+      return -1;
+  return 0;
+}
@@ -0,0 +1,331 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+// Test mmap(), munmap() and msync(), and compare random access
+// to a large file through a mapping with pread().
+//
+// usage: mmaptest [megabytes]
+
+#define PGSIZE   4096
+#define NACCESS  20000
+#define BUFSIZE  4096
+
+char *path = "mmapfile";
+char buf[BUFSIZE];
+
+uint randstate = 1;
+
+uint
+rand(void)
+{
+  randstate = randstate * 1664525 + 1013904223;
+  return randstate;
+}
+
+// Create path with size bytes; word i holds i.
+int
+mkfile(int size)
+{
+  int fd, i, j;
+
+  unlink(path);
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0)
+    return -1;
+  for(i = 0; i < size; i += BUFSIZE){
+    for(j = 0; j < BUFSIZE; j += 4)
+      *(int*)(buf + j) = (i + j) / 4;
+    if(write(fd, buf, BUFSIZE) != BUFSIZE){
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+void
+test1(int size)
+{
+  int fd, i, v, start, ticks1, ticks2;
+  int *p;
+  uint w;
+
+  // Random reads of a private, read-only mapping.
+  if((fd = mkfile(size)) < 0){
+    printf(1, "panic at mkfile\n");
+    return;
+  }
+  p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf(1, "panic at mmap\n");
+    return;
+  }
+
+  start = uptime();
+  for(i = 0; i < NACCESS; i++){
+    w = rand() % (size / 4);
+    if(p[w] != w){
+      printf(1, "panic at test1: word %d is %d\n", w, p[w]);
+      return;
+    }
+  }
+  ticks1 = uptime() - start;
+
+  start = uptime();
+  for(i = 0; i < NACCESS; i++){
+    w = rand() % (size / 4);
+    if(pread(fd, &v, 4, w * 4) != 4 || v != w){
+      printf(1, "panic at test1: pread\n");
+      return;
+    }
+  }
+  ticks2 = uptime() - start;
+
+  printf(1, "%d random reads of a %dKB file: mmap %d ticks, pread %d ticks\n",
+         NACCESS, size / 1024, ticks1, ticks2);
+
+  // Read-only memory cannot be the target of read().
+  if(read(fd, p, 4) >= 0){
+    printf(1, "panic at test1: read into PROT_READ mapping\n");
+    return;
+  }
+  if(munmap(p, size) < 0){
+    printf(1, "panic at munmap\n");
+    return;
+  }
+  close(fd);
+  printf(1, "Test 1 is done!\n");
+}
+
+void
+test2()
+{
+  int fd, i;
+  char *p;
+
+  // Writes to a shared mapping reach the file, but do not
+  // make it longer; munmap() may split a mapping.
+  if((fd = mkfile(4 * PGSIZE)) < 0){
+    printf(1, "panic at mkfile\n");
+    return;
+  }
+  p = mmap(0, 5 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(1, "panic at mmap\n");
+    return;
+  }
+  for(i = 0; i < 5; i++)
+    p[i * PGSIZE] = 'a' + i;
+  if(msync(p, PGSIZE) < 0 || pread(fd, buf, 1, 0) != 1 || buf[0] != 'a'){
+    printf(1, "panic at test2: msync\n");
+    return;
+  }
+  if(munmap(p + PGSIZE, PGSIZE) < 0){
+    printf(1, "panic at test2: munmap\n");
+    return;
+  }
+  if(p[2 * PGSIZE] != 'c'){
+    printf(1, "panic at test2: lost page after split\n");
+    return;
+  }
+  p[3 * PGSIZE] = 'D';
+  if(munmap(p, 5 * PGSIZE) < 0){
+    printf(1, "panic at test2: munmap\n");
+    return;
+  }
+  for(i = 0; i < 4; i++){
+    if(pread(fd, buf, 1, i * PGSIZE) != 1 || buf[0] != "abcD"[i]){
+      printf(1, "panic at test2: page %d not written back\n", i);
+      return;
+    }
+  }
+  if(pread(fd, buf, 1, 4 * PGSIZE) != 0){
+    printf(1, "panic at test2: file grew\n");
+    return;
+  }
+  close(fd);
+  printf(1, "Test 2 is done!\n");
+}
+
+void
+test3()
+{
+  int fd, pid;
+  char *p;
+
+  // Writes to a private mapping stay private, across fork too.
+  if((fd = mkfile(PGSIZE)) < 0){
+    printf(1, "panic at mkfile\n");
+    return;
+  }
+  p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf(1, "panic at mmap\n");
+    return;
+  }
+  p[0] = 'x';
+  pid = fork();
+  if(pid == 0){
+    p[0] = 'y';
+    exit();
+  }
+  wait();
+  if(p[0] != 'x' || pread(fd, buf, 1, 0) != 1 || buf[0] != 0){
+    printf(1, "panic at test3\n");
+    return;
+  }
+  munmap(p, PGSIZE);
+  close(fd);
+  printf(1, "Test 3 is done!\n");
+}
+
+void
+test4()
+{
+  int pid, i;
+  int *p;
+
+  // Anonymous shared memory is shared with children.
+  p = mmap(0, 16 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if(p == MAP_FAILED){
+    printf(1, "panic at mmap\n");
+    return;
+  }
+  p[0] = 1;
+  pid = fork();
+  if(pid == 0){
+    for(i = 0; i < 16; i++)
+      p[i * PGSIZE / 4] += 1;
+    exit();
+  }
+  wait();
+  for(i = 0; i < 16; i++){
+    if(p[i * PGSIZE / 4] != (i == 0 ? 2 : 1)){
+      printf(1, "panic at test4: page %d\n", i);
+      return;
+    }
+  }
+  munmap(p, 16 * PGSIZE);
+  printf(1, "Test 4 is done!\n");
+}
+
+void
+test5()
+{
+  int fd, fds[2];
+  int *p;
+
+  // The kernel copies to and from mappings of the file
+  // it is reading, and into pipes.
+  if((fd = mkfile(2 * PGSIZE)) < 0){
+    printf(1, "panic at mkfile\n");
+    return;
+  }
+  p = mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(1, "panic at mmap\n");
+    return;
+  }
+  if(pread(fd, p, PGSIZE, PGSIZE) != PGSIZE || p[0] != PGSIZE / 4){
+    printf(1, "panic at test5: pread into mapping\n");
+    return;
+  }
+  pipe(fds);
+  if(write(fds[1], p + PGSIZE / 4, 4) != 4 || read(fds[0], buf, 4) != 4 ||
+     *(int*)buf != PGSIZE / 4){
+    printf(1, "panic at test5: pipe\n");
+    return;
+  }
+  close(fds[0]);
+  close(fds[1]);
+  munmap(p, 2 * PGSIZE);
+  close(fd);
+  printf(1, "Test 5 is done!\n");
+}
+
+void
+test6()
+{
+  int id, i;
+  int *p, *q, *r;
+
+  // Pages of a shared-memory segment keep their place
+  // after part of a mapping of it is unmapped.
+  if((id = shmget(0, 4 * PGSIZE)) < 0){
+    printf(1, "panic at shmget\n");
+    return;
+  }
+  p = shmat(id);
+  q = shmat(id);
+  r = shmat(id);
+  if(p == (void*)-1 || q == (void*)-1 || r == (void*)-1){
+    printf(1, "panic at shmat\n");
+    return;
+  }
+  for(i = 0; i < 4; i++)
+    p[i * PGSIZE / 4] = i;
+  // Trim the front of q and split r, before either has faulted.
+  if(munmap(q, PGSIZE) < 0 || munmap((char*)r + PGSIZE, PGSIZE) < 0){
+    printf(1, "panic at munmap\n");
+    return;
+  }
+  for(i = 1; i < 4; i++){
+    if(q[i * PGSIZE / 4] != i){
+      printf(1, "panic at test6: page %d after trim\n", i);
+      return;
+    }
+  }
+  if(r[0] != 0 || r[2 * PGSIZE / 4] != 2 || r[3 * PGSIZE / 4] != 3){
+    printf(1, "panic at test6: split\n");
+    return;
+  }
+  q[3 * PGSIZE / 4] = 33;
+  if(p[3 * PGSIZE / 4] != 33){
+    printf(1, "panic at test6: write\n");
+    return;
+  }
+  shmdt(p);
+  shmdt((char*)q + PGSIZE);
+  shmdt(r);
+  shmdt((char*)r + 2 * PGSIZE);
+  shmrm(id);
+  printf(1, "Test 6 is done!\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb;
+
+  mb = 4;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1 || mb > 16){
+    printf(2, "usage: mmaptest [1-16]\n");
+    exit();
+  }
+
+  printf(1, "===========Test1===========\n");
+  test1(mb * 1024 * 1024);
+
+  printf(1, "===========Test2===========\n");
+  test2();
+
+  printf(1, "===========Test3===========\n");
+  test3();
+
+  printf(1, "===========Test4===========\n");
+  test4();
+
+  printf(1, "===========Test5===========\n");
+  test5();
+
+  printf(1, "===========Test6===========\n");
+  test6();
+
+  unlink(path);
+  printf(1, "All tests are done\n");
+  exit();
+}
@@ -38,6 +38,8 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
+#define CR4_OSFXSR      0x00000200      // OS supports fxsave and SSE
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -45,9 +47,10 @@
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_UTID  6  // limit is the tid of the running thread
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
@@ -123,8 +126,10 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SUPERPGSIZE     (NPTENTRIES*PGSIZE) // bytes mapped by a PTE_PS directory entry
 
 #define PGSHIFT         12      // log2(PGSIZE)
+#define SUPERPGORDER    10      // log2(SUPERPGSIZE/PGSIZE)
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
 
@@ -140,7 +145,14 @@ struct segdesc {
 #define PTE_A           0x020   // Accessed
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
-#define PTE_MBZ         0x180   // Bits must be zero
+#define PTE_G           0x100   // Global: kept in the TLB when %cr3 is loaded
+#define PTE_COW         0x200   // Copy-on-write (available to software)
+#define PTE_SWAP        0x400   // Not present: on swap (available to software)
+
+// Page fault error code bits
+#define FEC_PR          0x1     // Fault on present page (protection)
+#define FEC_WR          0x2     // Fault caused by a write
+#define FEC_U           0x4     // Fault occurred in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
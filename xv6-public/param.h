@@ -1,9 +1,9 @@
-#define NPROC        64  // maximum number of processes
+#define NTHREAD      64  // maximum number of threads per process (tid 0 is master)
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mmap() regions per address space
+#define KMAXORDER    10  // largest kalloc_order() block: 2^10 pages, a superpage
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -11,4 +11,5 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       40000  // size of file system in blocks
+#define SWAPSIZE     65536  // size of swap area after it, in blocks
 
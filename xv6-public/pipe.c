@@ -7,6 +7,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 
 #define PIPESIZE 512
 
@@ -19,6 +20,22 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+struct kmcache *pipecache;
+
+static void
+pipector(void *v)
+{
+  struct pipe *p = v;
+
+  initlock(&p->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kmcreate("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +45,12 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kmalloc(pipecache)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
-  initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -48,7 +64,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    kmfree(pipecache, p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,37 +85,55 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kmfree(pipecache, p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// The caller's memory is copied to or from a buffer on the
+// kernel stack without p->lock held: touching it may fault and
+// sleep to read a page back from swap.
+// If nonblock is set and the pipe is full, return the number
+// of bytes written so far, or EWOULDBLOCK if there are none.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  char buf[PIPESIZE];
+  int i, j, m;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  for(i = 0; i < n; i += m){
+    m = n - i < PIPESIZE ? n - i : PIPESIZE;
+    memmove(buf, addr + i, m);
+    acquire(&p->lock);
+    for(j = 0; j < m; j++){
+      while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(p->readopen == 0 || myproc()->killed){
+          release(&p->lock);
+          return -1;
+        }
+        if(nonblock){
+          wakeup(&p->nread);
+          release(&p->lock);
+          return i + j > 0 ? i + j : EWOULDBLOCK;
+        }
+        wakeup(&p->nread);
+        sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->data[p->nwrite++ % PIPESIZE] = buf[j];
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    release(&p->lock);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
   return n;
 }
 
+// If nonblock is set and the pipe is empty but still
+// open for writing, return EWOULDBLOCK.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
+  char buf[PIPESIZE];
   int i;
 
   acquire(&p->lock);
@@ -108,14 +142,19 @@ piperead(struct pipe *p, char *addr, int n)
       release(&p->lock);
       return -1;
     }
+    if(nonblock){
+      release(&p->lock);
+      return EWOULDBLOCK;
+    }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n && i < PIPESIZE; i++){  //DOC: piperead-copy
     if(p->nread == p->nwrite)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    buf[i] = p->data[p->nread++ % PIPESIZE];
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
+  memmove(addr, buf, i);
   return i;
 }
@@ -6,12 +6,24 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "vm.h"
+#include "memstat.h"
 
 #define MLFQ_MIN_PORTION 20
-
+#define NPIDHASH 256  // buckets of the pid hash
+#define PMBATCH  8    // processes procmem() looks up per pass
+
+// Processes and threads are allocated from a slab cache as they
+// are created, so their number is limited only by memory. The
+// scheduler and other scans go down the list of all of them;
+// lookups by pid go through the hash, in which a thread is
+// found under the pid of its process.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct kmcache *cache;
+  struct proc *list;                // oldest first
+  struct proc *tail;
+  struct proc *pidhash[NPIDHASH];
 } ptable;
 
 struct {
@@ -25,17 +37,108 @@ struct {
 static struct proc *initproc;
 
 int nextpid = 1;
-int nexttid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void setparent1(struct proc*, struct proc*);
+static void thread_exited(struct proc*);
+static void reap_detached(struct proc*);
 void cleanup_thread(struct proc*);
 
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  ptable.cache = kmcreate("proc", sizeof(struct proc), 0);
+}
+
+// First process or thread in the hash chain of pid. Callers
+// follow pidnext and skip the other pids in the chain.
+// The ptable lock must be held.
+static struct proc*
+pidchain(int pid)
+{
+  return ptable.pidhash[(uint)pid % NPIDHASH];
+}
+
+// Enter p in the hash under p->pid.
+// The ptable lock must be held.
+static void
+pidlink(struct proc *p)
+{
+  struct proc **pp;
+
+  pp = &ptable.pidhash[(uint)p->pid % NPIDHASH];
+  p->pidnext = *pp;
+  *pp = p;
+}
+
+// Remove p from the hash.
+// The ptable lock must be held.
+static void
+pidunlink(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[(uint)p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      return;
+    }
+  }
+  panic("pidunlink");
+}
+
+// Free p and its kernel stack. Everything else p held
+// must have been released.
+// The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  kfree(p->kstack);
+  if(p->parent)
+    setparent1(p, 0);
+  pidunlink(p);
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    ptable.list = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  else
+    ptable.tail = p->prev;
+  kmfree(ptable.cache, p);
+}
+
+// Make p a child of parent, or of nobody if parent is 0.
+// The ptable lock must be held.
+static void
+setparent1(struct proc *p, struct proc *parent)
+{
+  struct proc **pp;
+
+  if(p->parent){
+    for(pp = &p->parent->children; *pp && *pp != p; pp = &(*pp)->sibling)
+      ;
+    if(*pp == 0)
+      panic("setparent");
+    *pp = p->sibling;
+  }
+  p->parent = parent;
+  p->sibling = 0;
+  if(parent){
+    p->sibling = parent->children;
+    parent->children = p;
+  }
+}
+
+void
+setparent(struct proc *p, struct proc *parent)
+{
+  acquire(&ptable.lock);
+  setparent1(p, parent);
+  release(&ptable.lock);
 }
 
 // Must be called with interrupts disabled
@@ -78,36 +181,41 @@ myproc(void) {
 }
 
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
-// Otherwise return 0.
+// Allocate a proc and its kernel stack, add it to the
+// process table in state EMBRYO and initialize state
+// required to run in the kernel.
+// Returns 0 if out of memory.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
   char *sp;
 
-  acquire(&ptable.lock);
+  if((p = kmalloc(ptable.cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  fdinit(&p->fdt);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
+  // Allocate kernel stack.
+  if((p->kstack = kalloc()) == 0){
+    kmfree(ptable.cache, p);
+    return 0;
+  }
 
-  release(&ptable.lock);
-  return 0;
+  acquire(&ptable.lock);
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->prev = ptable.tail;
+  if(ptable.tail)
+    ptable.tail->next = p;
+  else
+    ptable.list = p;
+  ptable.tail = p;
+  pidlink(p);
 
   release(&ptable.lock);
 
-  // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
-    return 0;
-  }
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -123,17 +231,9 @@ found:
   p->context = (struct context*)sp;
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
-  
-  p->schedmode = 0;
-  p->tid = 0;
-  p->master = 0;
-
-  // Init data of stride & mlfq
-  memset(&p->stride, 0, sizeof p->stride);
-  memset(&p->mlfq, 0, sizeof p->mlfq);
-  
-  memset(&p->blankvm, 0, sizeof p->blankvm);
 
+  // Everything else, including data of stride & mlfq,
+  // starts out zero.
   return p;
 }
 
@@ -143,15 +243,17 @@ void
 userinit(void)
 {
   struct proc *p;
+  pde_t *pgdir;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
   p = allocproc();
   
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
-  inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
+  inituvm(pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  if((p->vm = vmcreate(pgdir, PGSIZE)) == 0)
+    panic("userinit: no vm");
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -182,30 +284,31 @@ growproc(int n)
 {
   uint sz, oldsz;
   struct proc *curproc = myproc();
-  struct proc *p;
-
-  acquire(&ptable.lock);
+  struct vm *vm = curproc->vm;
 
-  // Grow up master's size if current process is thread
-  p = (curproc->master) ? curproc->master : curproc;
+  // Memory is shared by all threads of this process,
+  // so only its address space has to be locked.
+  acquire(&vm->lock);
 
-  sz = p->sz;
+  sz = vm->sz;
   oldsz = sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Pages are allocated on first touch, by pagefault().
+    if(sz + n > MMAPBASE || sz + n < sz)
       goto bad;
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Thread stacks, live or kept in blankvm, are not sbrk()
+    // memory; do not free them.
+    if((uint)-n > sz - vm->stacktop || (sz = vmdealloc(vm, sz, sz + n)) == 0)
       goto bad;
   }
-  p->sz = sz;
-  release(&ptable.lock);
-
-  switchuvm(curproc);
+  vm->sz = sz;
+  release(&vm->lock);
   return oldsz;
 
 bad:
-  release(&ptable.lock);
+  release(&vm->lock);
   return -1;
 }
 
@@ -215,40 +318,49 @@ bad:
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
+  uint sz;
+  pde_t *pgdir;
   struct proc *np;
   struct proc *curproc = myproc();
+  struct vm *vm = curproc->vm;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
   
-  // Cause memory spaces is managed on master thread,
-  // use master's sz on slave's thread
-  if(curproc->tid > 0){
-    np->pgdir = copyuvm(curproc->pgdir, curproc->master->sz);
-  }else{
-    np->pgdir = copyuvm(curproc->pgdir, curproc->sz);
-  }
+  // Memory is shared with other threads of this process,
+  // so keep them from changing it while copying
+  acquire(&vm->lock);
+  sz = vm->sz;
+  pgdir = copyuvm(vm);
+  if(pgdir && (np->vm = vmcreate(pgdir, sz)) != 0)
+    mmapdup(np->vm, vm);
+  release(&vm->lock);
 
   // Check for error
-  if(np->pgdir == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  if(pgdir == 0 || np->vm == 0){
+    if(pgdir)
+      freevm(pgdir);
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  if(fdcopy(&np->fdt, &curproc->fdt) < 0){
+    mmapclose(np->vm);
+    vmput(np->vm);
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
-  np->sz = curproc->sz;
-  np->parent = curproc;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
@@ -257,6 +369,75 @@ fork(void)
 
   acquire(&ptable.lock);
 
+  setparent1(np, curproc);
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+  return pid;
+}
+
+// Create a new child of the current process running the
+// program at path with argv, in an address space of its own
+// rather than a copy of the parent's. If fds is not 0, the
+// child's fd i, for i < nfd, is the parent's fd fds[i] (none
+// if that is not open), and it has no others; otherwise it
+// gets all of the parent's fds, as with fork().
+// Returns the child's pid, or -1 on failure.
+int
+spawn(char *path, char **argv, int *fds, int nfd)
+{
+  int i, r, pid;
+  uint sp, entry;
+  struct vm *vm;
+  struct file *f;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(fds && nfd < 0)
+    return -1;
+  if((vm = execload(path, argv, &entry, &sp)) == 0)
+    return -1;
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    mmapclose(vm);
+    vmput(vm);
+    return -1;
+  }
+  if(fds == 0)
+    r = fdcopy(&np->fdt, &curproc->fdt);
+  else
+    for(i = 0, r = 0; i < nfd && r == 0; i++)
+      if((f = fdget(&curproc->fdt, fds[i])) != 0 && (r = fdinstall(&np->fdt, i, f)) == 0)
+        filedup(f);
+  if(r < 0){
+    fdcloseall(&np->fdt);
+    mmapclose(vm);
+    vmput(vm);
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  np->vm = vm;
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  np->tf->esp = sp;
+  np->tf->eip = entry;  // main
+
+  np->cwd = idup(curproc->cwd);
+
+  safestrcpy(np->name, execname(path), sizeof(np->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  setparent1(np, curproc);
   np->state = RUNNABLE;
 
   release(&ptable.lock);
@@ -271,7 +452,7 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd, slavecnt;
+  int tid, slavecnt;
   
   if(curproc == initproc)
     panic("init exiting");
@@ -283,35 +464,35 @@ exit(void)
 
     for(;;){
       slavecnt = 0;
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->master == curproc){
-          // If slave thread is already zombie, clean-up it
-          // Else, kill slave and wait for it
-          if(p->state == ZOMBIE){
-            cleanup_thread(p);
-
-          }else{
-            slavecnt++;
-            p->killed = 1;
-            wakeup1(p);
-          }
+      for(tid = 1; tid < NTHREAD; tid++){
+        if((p = curproc->threads[tid]) == 0 || p->master != curproc)
+          continue;
+
+        // If slave thread is already zombie, clean-up it
+        // Else, kill slave and wait for it
+        if(p->state == ZOMBIE){
+          cleanup_thread(p);
+
+        }else{
+          slavecnt++;
+          p->killed = 1;
+          wakeup1(p);
         }
       }
       if(slavecnt == 0){
         release(&ptable.lock);
         break;
       }
-      // Wait for slaves to exit.  (See wakeup1 call in proc_exit.)
-      sleep(curproc, &ptable.lock);
+      // Wait for slaves to exit.  (See wakeup1 call in thread_exited.)
+      sleep(curproc->threads, &ptable.lock);
     }
+
+    // Write back shared file mappings while the
+    // files can still be written.
+    mmapclose(curproc->vm);
   }
   
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
+  fdcloseall(&curproc->fdt);
 
   begin_op();
   iput(curproc->cwd);
@@ -330,19 +511,18 @@ exit(void)
   }else{
     // If master is alive
     if(curproc->master != 0){
+      thread_exited(curproc);
       curproc->master->killed = 1;
       wakeup1(curproc->master);
     }
   }
 
   // Pass abandoned children to init.
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent == curproc){
-        p->parent = initproc;
-        if(p->state == ZOMBIE)
-          wakeup1(initproc);
-      }
-    }
+  while((p = curproc->children) != 0){
+    setparent1(p, initproc);
+    if(p->state == ZOMBIE)
+      wakeup1(initproc);
+  }
 
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
@@ -361,23 +541,14 @@ wait(void)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
+    // Scan through children looking for exited ones.
+    havekids = curproc->children != 0;
+    for(p = curproc->children; p; p = p->sibling){
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        vmput(p->vm);
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -403,7 +574,7 @@ mlfq_scheduler(void)
   
   // Run priority boosting if totaltick equals `MLFQ_BOOSTING_FREQUENCY`
   if (mlfqs.totaltick == MLFQ_BOOSTING_FREQUENCY){
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.list; p; p = p->next){
       if(p->state != RUNNABLE)
         continue;
 
@@ -423,7 +594,7 @@ mlfq_scheduler(void)
   struct proc *sp = 0;
 
   // Choose process by RR
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->state != RUNNABLE || p->schedmode != MLFQ_MODE)  
       continue;
     
@@ -487,6 +658,8 @@ mlfq_scheduler(void)
         }
         break;
     }
+
+    reap_detached(p);
   }    
   // Increase pass of whole mlfq,
   // then go back to schedule function,
@@ -505,7 +678,7 @@ getstride(struct proc* sp)
   if(sp->schedmode != STRIDE_MODE)
     panic("getstride");
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = pidchain(sp->pid); p; p = p->pidnext){
     if(p->pid == sp->pid)
       numthreads++;
   }
@@ -541,7 +714,7 @@ scheduler(void)
     int procnum = 0;
 
     // Find minpass of all process using stride
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.list; p; p = p->next){
       if(p->state != RUNNABLE)
         continue;
 
@@ -575,9 +748,15 @@ scheduler(void)
       
       p->stride.pass += getstride(p);
       c->proc = 0;
+
+      reap_detached(p);
     }
 
     release(&ptable.lock);
+
+    // Nothing to run: zero some free pages meanwhile.
+    if(procnum == 0)
+      kzerofill();
   }
 }
 
@@ -641,6 +820,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -693,7 +873,7 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = ptable.list; p; p = p->next)
     if(p->state == SLEEPING && p->chan == chan)
       p->state = RUNNABLE;
 }
@@ -717,7 +897,7 @@ kill(int pid)
   
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = pidchain(pid); p; p = p->pidnext){
     if(p->pid == pid && p->tid == 0){
       p->killed = 1;
       // Wake process from sleep if necessary.
@@ -753,9 +933,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
+  for(p = ptable.list; p; p = p->next){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -768,6 +946,59 @@ procdump(void)
     }
     cprintf("\n");
   }
+  kallocdump();
+  swapdump();
+}
+
+// Fill in pm[0..n-1] with the memory of each process, in order
+// of pid, for the procmem() system call. Each pass over the
+// process list picks the next PMBATCH processes by pid and
+// holds their address spaces; their page tables are walked
+// after ptable.lock is released. pm is user memory, already
+// checked, so it is also written with no locks held.
+// Returns the number of processes filled in.
+int
+procmem(struct procmem *pm, int n)
+{
+  struct procmem b[PMBATCH];
+  struct proc *bp[PMBATCH], *p;
+  struct vm *vm[PMBATCH];
+  int i, j, nb, want, last;
+
+  last = 0;
+  for(i = 0; i < n; ){
+    want = n - i < PMBATCH ? n - i : PMBATCH;
+    nb = 0;
+    acquire(&ptable.lock);
+    for(p = ptable.list; p; p = p->next){
+      if(p->state == EMBRYO || p->state == ZOMBIE || p->tid != 0 || p->vm == 0)
+        continue;
+      if(p->pid <= last || (nb == want && p->pid > bp[nb-1]->pid))
+        continue;
+      // Insert in order of pid; when full, the last one drops off.
+      if(nb < want)
+        nb++;
+      for(j = nb - 1; j > 0 && bp[j-1]->pid > p->pid; j--)
+        bp[j] = bp[j-1];
+      bp[j] = p;
+    }
+    for(j = 0; j < nb; j++){
+      b[j].pid = bp[j]->pid;
+      safestrcpy(b[j].name, bp[j]->name, sizeof(b[j].name));
+      vm[j] = vmdup(bp[j]->vm);
+    }
+    release(&ptable.lock);
+    if(nb == 0)
+      break;
+
+    for(j = 0; j < nb; j++){
+      uvmstat(vm[j], &b[j]);
+      vmput(vm[j]);
+      pm[i++] = b[j];
+    }
+    last = b[nb-1].pid;
+  }
+  return i;
 }
 
 // Reset pass of all processes using stride scheduling.
@@ -777,7 +1008,7 @@ reset_strides(void)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->state != RUNNABLE || p->schedmode != STRIDE_MODE)
       continue;
     p->stride.pass = 0;
@@ -801,7 +1032,7 @@ set_cpu_share(int cpu_share)
 
   mlfqs.totalcpu += cpu_share;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = pidchain(curproc->pid); p; p = p->pidnext){
     if(p->pid == curproc->pid){
       p->schedmode = STRIDE_MODE;
       p->stride.cpu_share = cpu_share;
@@ -820,9 +1051,9 @@ set_cpu_share(int cpu_share)
 int
 thread_create(thread_t* thread, void* (*start_routine)(void *), void* arg)
 {
-  int i;
+  int tid;
   uint sz, sp, vabase;
-  pde_t *pgdir;
+  struct vm *vm;
   struct proc *np;
   struct proc *curproc = myproc();
   struct proc *master = curproc->master ? curproc->master : curproc;
@@ -833,32 +1064,64 @@ thread_create(thread_t* thread, void* (*start_routine)(void *), void* arg)
   }
 
   --nextpid;
-  
-  // Set thread-dependant properties
-  np->master = master;
-  np->pid = master->pid;
-  np->tid = nexttid++;
 
-  acquire(&ptable.lock);
-  pgdir = master->pgdir;
-  
-  // If there is blank memory on process, use it.
-  // Else, grow vm and give new thread memory located at the top
-  if(master->blankvm.size){
-    vabase = master->blankvm.data[--master->blankvm.size]; // Pop on stack
+  // Copy open files first, while nothing else has to be undone.
+  if(fdcopy(&np->fdt, &master->fdt) < 0){
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
 
+  // Reserve two pages for the stack of new thread.
+  // If there is blank memory on process, use it.
+  // Else, grow vm and give new thread memory located at the top.
+  // Like sbrk() memory, the pages are allocated on first touch.
+  vm = master->vm;
+  acquire(&vm->lock);
+
+  if(vm->blankvm.size){
+    vabase = vm->blankvm.data[--vm->blankvm.size]; // Pop on stack
+    sz = vabase + 2*PGSIZE;
   }else{
-    vabase = master->sz;
-    master->sz += 2*PGSIZE;
+    vabase = PGROUNDUP(vm->sz);
+    if(vabase + 2*PGSIZE > MMAPBASE)
+      sz = 0;
+    else
+      vm->sz = vm->stacktop = sz = vabase + 2*PGSIZE;
   }
+  //clearpteu(vm->pgdir, (char*)(sz - 2*PGSIZE));
 
-  // Allocate two pages for current thread.
-  // Make the first inaccessible. Use the second as the user stack for new thread
-  if((sz = allocuvm(pgdir, vabase, vabase + 2*PGSIZE)) == 0){
-    np->state = UNUSED;  
-    return -1;
+  release(&vm->lock);
+
+  if(sz == 0)
+    goto bad;
+
+  acquire(&ptable.lock);
+
+  // Tid is the index of a free slot in master's thread table
+  for(tid = 1; tid < NTHREAD; tid++)
+    if(master->threads[tid] == 0)
+      break;
+  if(tid == NTHREAD){
+    release(&ptable.lock);
+
+    acquire(&vm->lock);
+    vm->blankvm.data[vm->blankvm.size++] = vabase;
+    release(&vm->lock);
+    goto bad;
   }
-  //clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
+
+  // Set thread-dependant properties
+  np->master = master;
+  pidunlink(np);
+  np->pid = master->pid;
+  pidlink(np);
+  np->tid = tid;
+  np->vm = vmdup(vm);
+  np->vabase = vabase;
+  master->threads[tid] = np;
+
   release(&ptable.lock);
 
   // Copy states
@@ -870,9 +1133,6 @@ thread_create(thread_t* thread, void* (*start_routine)(void *), void* arg)
     reset_strides();
   }
 
-  for(i = 0; i < NOFILE; i++)
-    if(master->ofile[i])
-      np->ofile[i] = filedup(master->ofile[i]);
   np->cwd = idup(master->cwd);
 
   safestrcpy(np->name, master->name, sizeof(master->name));
@@ -882,9 +1142,6 @@ thread_create(thread_t* thread, void* (*start_routine)(void *), void* arg)
   sp -= 4;
   *((uint*)sp) = 0xffffffff; // fake return PC
 
-  np->pgdir = pgdir;
-  np->vabase = vabase;
-  np->sz = sz;
   np->tf->eip = (uint)start_routine; // entry point of this thread
   np->tf->esp = sp; // set stack pointer
 
@@ -899,6 +1156,13 @@ thread_create(thread_t* thread, void* (*start_routine)(void *), void* arg)
   release(&ptable.lock);
   
   return 0;
+
+bad:
+  fdcloseall(&np->fdt);
+  acquire(&ptable.lock);
+  freeproc(np);
+  release(&ptable.lock);
+  return -1;
 }
 
 // Terminate the thread
@@ -908,15 +1172,9 @@ void
 thread_exit(void* retval)
 {
   struct proc *curproc = myproc();
-  int fd;
 
   // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
+  fdcloseall(&curproc->fdt);
 
   begin_op();
   iput(curproc->cwd);
@@ -928,8 +1186,8 @@ thread_exit(void* retval)
   // Save retval temporarily
   curproc->tmp_retval = retval;
 
-  // Master process might be sleeping in wait().
-  wakeup1(curproc->master);
+  // Master process might be sleeping in thread_join().
+  thread_exited(curproc);
 
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
@@ -945,6 +1203,7 @@ int
 thread_join(thread_t thread, void** retval)
 {
   struct proc *p;
+  void *ret;
   struct proc *curproc = myproc();
   
   // Slave thread cannot call thread_join
@@ -952,60 +1211,171 @@ thread_join(thread_t thread, void** retval)
     return -1;
   }
 
+  if(thread == 0 || thread >= NTHREAD)
+    return -1;
+
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited slave threads.
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->tid != thread)
-        continue;
-      
-      // Only master of the slave thread can call thread_join
-      if(p->master != curproc){
-        release(&ptable.lock);
-        return -1;
-      }
+    // Look up slave thread by its tid.
+    // Only master of the slave thread can call thread_join,
+    // and detached thread could not be joined.
+    p = curproc->threads[thread];
+    if(p == 0 || p->master != curproc || p->detached){
+      release(&ptable.lock);
+      return -1;
+    }
 
-      if(p->state == ZOMBIE){
-        // Found one.
-        *retval = p->tmp_retval;
-        cleanup_thread(p);
+    if(p->state == ZOMBIE){
+      // Found one.
+      ret = p->tmp_retval;
+      cleanup_thread(p);
+      release(&ptable.lock);
 
-        release(&ptable.lock);
-        return 0;
-      }
+      // Store to user memory only now: the page may have
+      // been swapped out or made copy-on-write while we slept,
+      // and faulting it back in can sleep.
+      *retval = ret;
+      return 0;
     }
 
     if(curproc->killed){
       release(&ptable.lock);
       return -1;
     }
-    // Wait for slave thread to exit.  (See wakeup1 call in proc_exit.)
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    // Wait for this slave thread to exit.  (See wakeup1 call in thread_exited.)
+    sleep(p, &ptable.lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for any joinable thread of this process to exit.
+// Threads are reaped in the order they exited, and
+// tid of the reaped thread is returned through argument.
+// Returns -1 if there is no thread to join.
+int
+thread_join_any(thread_t* thread, void** retval)
+{
+  struct proc *p, *sp;
+  int tid, havethreads;
+  void *ret;
+  struct proc *curproc = myproc();
+
+  // Slave thread cannot call thread_join_any
+  if(curproc->master != 0){
+    return -1;
+  }
+
+  acquire(&ptable.lock);
+  for(;;){
+    // Choose slave thread which exited first.
+    sp = 0;
+    havethreads = 0;
+    for(tid = 1; tid < NTHREAD; tid++){
+      p = curproc->threads[tid];
+      if(p == 0 || p->master != curproc || p->detached)
+        continue;
+      havethreads = 1;
+      if(p->state == ZOMBIE && (sp == 0 || (int)(p->exitseq - sp->exitseq) < 0))
+        sp = p;
+    }
+
+    if((p = sp)){
+      // Found one.
+      tid = p->tid;
+      ret = p->tmp_retval;
+      cleanup_thread(p);
+      release(&ptable.lock);
+
+      // As in thread_join, not under ptable.lock.
+      *thread = tid;
+      *retval = ret;
+      return 0;
+    }
+
+    // No point waiting if we don't have any joinable threads.
+    if(!havethreads || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+
+    // Wait for slave threads to exit.  (See wakeup1 call in thread_exited.)
+    sleep(curproc->threads, &ptable.lock);
+  }
+}
+
+// Mark the thread detached, so that its resources are
+// released as soon as it exits, without thread_join.
+// Any thread of the process can detach any other one.
+int
+thread_detach(thread_t thread)
+{
+  struct proc *p;
+  struct proc *curproc = myproc();
+  struct proc *master = curproc->master ? curproc->master : curproc;
+
+  if(thread == 0 || thread >= NTHREAD)
+    return -1;
+
+  acquire(&ptable.lock);
+
+  p = master->threads[thread];
+  if(p == 0 || p->master != master || p->detached){
+    release(&ptable.lock);
+    return -1;
+  }
+
+  p->detached = 1;
+
+  // Nobody would join this thread, so clean-up it now
+  if(p->state == ZOMBIE)
+    cleanup_thread(p);
+
+  release(&ptable.lock);
+  return 0;
+}
+
+// Record order of exit of slave thread p and wake up
+// master which might be sleeping in thread_join(),
+// thread_join_any() or exit().
+// The ptable lock must be held.
+static void
+thread_exited(struct proc *p)
+{
+  p->exitseq = p->master->nexitseq++;
+  wakeup1(p);
+  wakeup1(p->master->threads);
+}
+
+// Clean up detached slave thread that has just exited.
+// Called by scheduler after p gives up the CPU, because
+// p could not free the kernel stack it was running on.
+// The ptable lock must be held.
+static void
+reap_detached(struct proc *p)
+{
+  if(p->state == ZOMBIE && p->master != 0 && p->detached)
+    cleanup_thread(p);
+}
+
 // Clean up resources of the thread.
-// Announce to master that area used by this thread
+// Announce to address space that area used by this thread
 // is currently blank so other could use it.
 // The ptable lock must be held.
 void
 cleanup_thread(struct proc *p)
 {
-  kfree(p->kstack);
-  p->kstack = 0;
-
-  p->master->blankvm.data[p->master->blankvm.size++] = p->vabase;
+  struct vm *vm = p->vm;
+  uint vabase = p->vabase;
 
-  p->pid = 0;
-  p->parent = 0;
-  p->master = 0;
-  p->name[0] = 0;
-  p->killed = 0;
-  p->state = UNUSED;
+  p->master->threads[p->tid] = 0;
+  freeproc(p);
 
   // Deallocate memory area of this thread
-  deallocuvm(p->pgdir, p->sz, p->vabase);
+  acquire(&vm->lock);
+  vmdealloc(vm, vabase + 2*PGSIZE, vabase);
+  vm->blankvm.data[vm->blankvm.size++] = vabase;
+  release(&vm->lock);
 
+  vmput(vm);
 }
 
 // Called by `exec()` function.
@@ -1024,7 +1394,7 @@ kill_except(int pid, struct proc* except)
     return;
   }
   
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = pidchain(pid); p; p = p->pidnext){
     if (p->pid == pid && p != except){
       p->killed = 1;
       p->chan = 0;
@@ -1048,14 +1418,14 @@ wakeup_except(int pid, struct proc* except)
   acquire(&ptable.lock);
   havekids = 0;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = pidchain(pid); p; p = p->pidnext){
     if (p->pid == pid && p != except){
       p->state = RUNNABLE;
 
       // Process `except` inherits original process,
       // so collector of this process should be `except` proc
       if(p->parent){
-        p->parent = except;
+        setparent1(p, except);
         havekids = 1;
       }
     }
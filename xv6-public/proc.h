@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct vm *vm;               // Address space loaded in %cr3 or null
 };
 
 extern struct cpu cpus[NCPU];
@@ -67,26 +68,36 @@ struct stridedata {
   int cpu_share;              // Allocated percentate of cpu (set by cpu_share function)
 };
 
-// When thread is cleaned up, its memeory spaces is saved to blankvm of master's
-// so that new thread could use memory space in blankvm, not by growing sz of master
-struct blankvm {
-  uint data[NPROC];
-  int size;
+// Open files of a process, indexed by fd. The first NOFILE slots
+// are in the table itself; past them it moves to a block from
+// kalloc_order(), twice as large each time it grows. Bit fd of
+// used is set if slot fd is taken, so the lowest free fd is found
+// a word at a time, from the first word that may have one.
+// Only the process itself changes its table.
+struct fdtable {
+  struct file **ofile;         // nfd slots
+  uint *used;                  // bitmap of taken slots
+  int nfd;
+  int order;                   // order of the block, or -1 if in the table
+  int hint;                    // words of used before this one are full
+  struct file *ofile0[NOFILE];
+  uint used0[(NOFILE+31)/32];
 };
 
 // Per-process state
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
-  pde_t* pgdir;                // Page table
+  struct vm *vm;               // Address space (shared with threads of same process)
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // Child processes, linked by sibling
+  struct proc *sibling;        // Next child of parent
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct fdtable fdt;          // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 
@@ -98,9 +109,15 @@ struct proc {
   int tid;                     // Thread id (0 if this is not slave thread)
   struct proc *master;         // Master thread of this process
   void* tmp_retval;            // Temporally saved return-value of thread
-  uint vabase;                 // Base of virtual address (Base of normal process is 0, but slave thread has special base addr)
-  struct blankvm blankvm;      // Currently blanks of memory space of "master" thread's (slave do NOT use this)
-                            
+  uint vabase;                 // Base of two-page stack area of slave thread
+  int detached;                // If non-zero, slave is reaped on exit and cannot be joined
+  uint exitseq;                // Order in which this slave exited (see thread_join_any)
+  uint nexitseq;               // Next exit sequence number handed to slaves (master only)
+  struct proc *threads[NTHREAD]; // Slave threads indexed by tid (master only, slot 0 unused)
+
+  struct proc *next;           // On the list of all processes, in order of allocation
+  struct proc *prev;
+  struct proc *pidnext;        // Next in the hash chain of pid
 };
 
 
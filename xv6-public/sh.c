@@ -3,6 +3,8 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,12 +54,18 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
-// Execute cmd.  Never returns.
-void
-runcmd(struct cmd *cmd)
+// Start cmd, with fds 0, 1 and 2 of its processes taken from
+// the shell's fd[0], fd[1] and fd[2]. Commands are spawned from
+// the shell itself rather than from a copy of it; only background
+// commands go through a forked shell, which exits at once.
+// Returns the number of processes started, to wait for.
+int
+startcmd(struct cmd *cmd, int *fd)
 {
-  int p[2];
+  int i, n, f, p[2], cfd[3];
+  posix_spawn_file_actions_t fa;
   struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
@@ -65,69 +73,72 @@ runcmd(struct cmd *cmd)
   struct redircmd *rcmd;
 
   if(cmd == 0)
-    exit();
+    return 0;
 
   switch(cmd->type){
   default:
-    panic("runcmd");
+    panic("startcmd");
 
   case EXEC:
     ecmd = (struct execcmd*)cmd;
     if(ecmd->argv[0] == 0)
-      exit();
-    exec(ecmd->argv[0], ecmd->argv);
-    printf(2, "exec %s failed\n", ecmd->argv[0]);
-    break;
+      return 0;
+    posix_spawn_file_actions_init(&fa);
+    for(i = 0; i < 3; i++)
+      if(fd[i] != i)
+        posix_spawn_file_actions_adddup2(&fa, fd[i], i);
+    // Pipe ends and files opened for other commands are not its own.
+    for(i = 3; i < NOFILE; i++)
+      posix_spawn_file_actions_addclose(&fa, i);
+    if(posix_spawn(0, ecmd->argv[0], &fa, ecmd->argv) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
 
   case REDIR:
     rcmd = (struct redircmd*)cmd;
-    close(rcmd->fd);
-    if(open(rcmd->file, rcmd->mode) < 0){
+    if((f = open(rcmd->file, rcmd->mode)) < 0){
       printf(2, "open %s failed\n", rcmd->file);
-      exit();
+      return 0;
     }
-    runcmd(rcmd->cmd);
-    break;
+    memmove(cfd, fd, sizeof(cfd));
+    cfd[rcmd->fd] = f;
+    n = startcmd(rcmd->cmd, cfd);
+    close(f);
+    return n;
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait();
-    runcmd(lcmd->right);
-    break;
+    for(n = startcmd(lcmd->left, fd); n > 0; n--)
+      wait();
+    return startcmd(lcmd->right, fd);
 
   case PIPE:
     pcmd = (struct pipecmd*)cmd;
-    if(pipe(p) < 0)
-      panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      return 0;
     }
+    memmove(cfd, fd, sizeof(cfd));
+    cfd[1] = p[1];
+    n = startcmd(pcmd->left, cfd);
+    cfd[0] = p[0];
+    cfd[1] = fd[1];
+    n += startcmd(pcmd->right, cfd);
     close(p[0]);
     close(p[1]);
-    wait();
-    wait();
-    break;
+    return n;
 
   case BACK:
+    // The command's processes are left to init.
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(bcmd->cmd);
-    break;
+    if(fork1() == 0){
+      startcmd(bcmd->cmd, fd);
+      exit();
+    }
+    return 1;
   }
-  exit();
 }
 
 int
@@ -145,7 +156,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n, sfd[3];
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +176,14 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    sfd[0] = 0;
+    sfd[1] = 1;
+    sfd[2] = 2;
+    for(n = startcmd(cmd, sfd); n > 0; n--)
+      wait();
+    freecmd(cmd);
   }
   exit();
 }
@@ -324,18 +341,36 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell parses commands itself, so a syntax error
+// must not end it: it is noted, and the command dropped.
+int parseerr;
+
+void
+syntax(char *s)
+{
+  if(!parseerr)
+    printf(2, "%s\n", s);
+  parseerr = 1;
+}
+
+// Returns the command, or 0 if it has a syntax error.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
   if(s != es){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +414,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +442,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +470,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc + 1 >= MAXARGS){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +534,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
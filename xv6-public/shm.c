@@ -0,0 +1,201 @@
+// Shared-memory segments.
+//
+// A segment is a set of physical pages named by an integer key,
+// which any process may attach to its address space with shmat()
+// as a MAP_SHARED region (see mmap.c). Pages are allocated on
+// first touch and hold one reference for the segment plus one for
+// each page table they are mapped in. Attachments are inherited by
+// fork() and dropped by shmdt(), exit and exec.
+//
+// Like System V segments, a segment lives on without attachments
+// until it is removed with shmrm(); then it is freed as soon as
+// the last attachment is gone.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "vm.h"
+
+#define NSHM       16                   // maximum number of segments
+#define SHMMAXPG   (PGSIZE/sizeof(uint)) // maximum pages in a segment
+
+struct shm {
+  int key;          // 0 for a segment private to its creator
+  int npages;       // 0 if this slot is free
+  int nattach;      // regions mapping this segment
+  int removed;      // shmrm() called; free when nattach is 0
+  uint *pages;      // physical address of each page, or 0
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Free segment s. Caller holds shmtable.lock.
+static void
+shmfree(struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    if(s->pages[i])
+      kfree(P2V(s->pages[i]));
+  kfree((char*)s->pages);
+  memset(s, 0, sizeof(*s));
+}
+
+// Return the id of the segment with key, creating it with size
+// bytes if there is none and size is not 0. A key of 0 always
+// creates a new segment. Returns -1 on failure.
+int
+shmget(int key, int size)
+{
+  struct shm *s, *free;
+  int npages;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(size < 0 || npages > SHMMAXPG)
+    return -1;
+
+  acquire(&shmtable.lock);
+  free = 0;
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM]; s++){
+    if(s->npages == 0){
+      if(free == 0)
+        free = s;
+    } else if(key != 0 && s->key == key && !s->removed){
+      if(s->npages < npages)
+        break;
+      release(&shmtable.lock);
+      return s - shmtable.shm;
+    }
+  }
+  if(s < &shmtable.shm[NSHM] || npages == 0 || free == 0)
+    goto bad;
+  if((free->pages = (uint*)kalloc_zeroed()) == 0)
+    goto bad;
+  free->key = key;
+  free->npages = npages;
+  free->nattach = 0;
+  free->removed = 0;
+  release(&shmtable.lock);
+  return free - shmtable.shm;
+
+bad:
+  release(&shmtable.lock);
+  return -1;
+}
+
+// Attach segment id to address space vm.
+// Returns the address of the region, or -1 on failure.
+int
+shmat(struct vm *vm, int id)
+{
+  struct shm *s;
+  int addr;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtable.shm[id];
+  acquire(&shmtable.lock);
+  if(s->npages == 0 || s->removed){
+    release(&shmtable.lock);
+    return -1;
+  }
+  // Hold the segment while it is being mapped.
+  s->nattach++;
+  release(&shmtable.lock);
+
+  if((addr = mmapshm(vm, s, s->npages * PGSIZE)) < 0)
+    shmput(s);
+  return addr;
+}
+
+// Detach the segment attached at addr from vm.
+int
+shmdt(struct vm *vm, uint addr)
+{
+  struct vma *v;
+  uint end;
+
+  acquire(&vm->lock);
+  if((v = mmapfind(vm, addr)) == 0 || v->shm == 0 || v->start != addr){
+    release(&vm->lock);
+    return -1;
+  }
+  end = v->end;
+  release(&vm->lock);
+  return munmap(vm, addr, end);
+}
+
+// Mark segment id to be freed when it is no longer attached.
+int
+shmrm(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtable.shm[id];
+  acquire(&shmtable.lock);
+  if(s->npages == 0 || s->removed){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->removed = 1;
+  if(s->nattach == 0)
+    shmfree(s);
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Count one more region mapping s.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  s->nattach++;
+  release(&shmtable.lock);
+}
+
+// Drop a region mapping s.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  if(--s->nattach == 0 && s->removed)
+    shmfree(s);
+  release(&shmtable.lock);
+}
+
+// Return page i of s, allocating a zeroed page on first use,
+// with a reference taken for the caller's page table.
+// Returns 0 if out of memory.
+char*
+shmpage(struct shm *s, int i)
+{
+  char *mem;
+
+  acquire(&shmtable.lock);
+  if(s->pages[i] == 0){
+    if((mem = kalloc_zeroed()) == 0){
+      release(&shmtable.lock);
+      return 0;
+    }
+    s->pages[i] = V2P(mem);
+  }
+  mem = P2V(s->pages[i]);
+  kref(mem);
+  release(&shmtable.lock);
+  return mem;
+}
@@ -0,0 +1,143 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "shmring.h"
+
+// Producer/consumer throughput between two processes,
+// through a pipe and through a shared-memory ring.
+// The producer fills each 4KB chunk and the consumer
+// sums it, so both ways do the same work on the data.
+//
+// usage: shmbench [megabytes]
+
+#define CHUNK   4096
+#define NSLOTS  16
+#define KEY     0x5348
+
+char buf[CHUNK];
+
+void
+fill(int *p, int seq)
+{
+  int i;
+
+  for(i = 0; i < CHUNK / 4; i++)
+    p[i] = seq + i;
+}
+
+int
+sum(int *p, int n)
+{
+  int i, s;
+
+  s = 0;
+  for(i = 0; i < n / 4; i++)
+    s += p[i];
+  return s;
+}
+
+int
+expected(int nchunk)
+{
+  int i, s;
+
+  s = 0;
+  for(i = 0; i < nchunk; i++){
+    fill((int*)buf, i);
+    s += sum((int*)buf, CHUNK);
+  }
+  return s;
+}
+
+int
+bypipe(int nchunk)
+{
+  int fds[2], i, n, m, s;
+
+  if(pipe(fds) < 0)
+    return -1;
+  if(fork() == 0){
+    close(fds[0]);
+    for(i = 0; i < nchunk; i++){
+      fill((int*)buf, i);
+      if(write(fds[1], buf, CHUNK) != CHUNK)
+        printf(1, "shmbench: write failed\n");
+    }
+    exit();
+  }
+  close(fds[1]);
+  s = 0;
+  for(i = 0; i < nchunk; i++){
+    for(n = 0; n < CHUNK; n += m)
+      if((m = read(fds[0], buf + n, CHUNK - n)) <= 0)
+        return -1;
+    s += sum((int*)buf, CHUNK);
+  }
+  close(fds[0]);
+  wait();
+  return s;
+}
+
+int
+byshm(int nchunk)
+{
+  struct shmring *r;
+  int i, n, s;
+  void *p;
+
+  if((r = shmring_create(KEY, NSLOTS, CHUNK)) == 0)
+    return -1;
+  if(fork() == 0){
+    // Attach by key, as an unrelated process would;
+    // the ring inherited through fork() works as well.
+    shmring_detach(r);
+    if((r = shmring_attach(KEY)) == 0){
+      printf(1, "shmbench: attach failed\n");
+      exit();
+    }
+    for(i = 0; i < nchunk; i++){
+      fill(shmring_put(r), i);
+      shmring_commit(r, CHUNK);
+    }
+    shmring_close(r);
+    shmring_detach(r);
+    exit();
+  }
+  s = 0;
+  while((p = shmring_get(r, &n)) != 0){
+    s += sum(p, n);
+    shmring_release(r);
+  }
+  wait();
+  shmring_destroy(r);
+  if(shmget(KEY, 0) >= 0)
+    printf(1, "shmbench: segment not removed\n");
+  return s;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, nchunk, start, t, want, got;
+
+  mb = 16;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    printf(2, "usage: shmbench [megabytes]\n");
+    exit();
+  }
+  nchunk = mb * 1024 * 1024 / CHUNK;
+  want = expected(nchunk);
+
+  start = uptime();
+  got = bypipe(nchunk);
+  t = uptime() - start;
+  printf(1, "pipe: %dMB in %d ticks%s\n", mb, t, got == want ? "" : " (bad data)");
+
+  start = uptime();
+  got = byshm(nchunk);
+  t = uptime() - start;
+  printf(1, "shm:  %dMB in %d ticks%s\n", mb, t, got == want ? "" : " (bad data)");
+  exit();
+}
@@ -0,0 +1,166 @@
+// Shared-memory ring buffer; see shmring.h.
+//
+// The ring header takes the first page of the segment and the
+// slots follow it. head and tail only grow, and are kept in
+// different cache lines since each is written by one side only.
+// x86 does not reorder stores with stores nor loads with loads,
+// so compiler barriers are enough to order slot data with the
+// index that publishes it.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "shmring.h"
+
+#define PGSIZE        4096
+#define SHMRING_MAGIC 0x52696e67
+#define SHMRING_SPINS 64   // empty polls before giving up the CPU
+
+#define barrier()  asm volatile("" : : : "memory")
+
+struct shmring {
+  volatile uint magic;     // set by the creator once the ring is ready
+  int id;                  // shared-memory segment
+  int nslots;
+  int slotsize;
+  volatile int closed;     // producer is done
+  char pad1[64 - 5*sizeof(int)];
+  volatile uint head;      // next slot to consume; written by consumer
+  char pad2[64 - sizeof(uint)];
+  volatile uint tail;      // next slot to produce; written by producer
+  char pad3[64 - sizeof(uint)];
+  int len[SHMRING_MAXSLOTS];
+};
+
+static char*
+slot(struct shmring *r, uint i)
+{
+  return (char*)r + PGSIZE + (i % r->nslots) * r->slotsize;
+}
+
+// Create a ring of nslots slots of slotsize bytes under key.
+// Returns 0 on failure.
+struct shmring*
+shmring_create(int key, int nslots, int slotsize)
+{
+  struct shmring *r;
+  int id;
+
+  if(nslots < 1 || nslots > SHMRING_MAXSLOTS || slotsize < 1)
+    return 0;
+  if((id = shmget(key, PGSIZE + nslots * slotsize)) < 0)
+    return 0;
+  if((r = shmat(id)) == (void*)-1)
+    return 0;
+  r->id = id;
+  r->nslots = nslots;
+  r->slotsize = slotsize;
+  r->closed = 0;
+  r->head = 0;
+  r->tail = 0;
+  barrier();
+  r->magic = SHMRING_MAGIC;
+  return r;
+}
+
+// Attach to the ring created under key, waiting for its
+// creator to set it up. Returns 0 on failure.
+struct shmring*
+shmring_attach(int key)
+{
+  struct shmring *r;
+  int id;
+
+  if((id = shmget(key, 0)) < 0)
+    return 0;
+  if((r = shmat(id)) == (void*)-1)
+    return 0;
+  while(r->magic != SHMRING_MAGIC)
+    yield();
+  barrier();
+  return r;
+}
+
+void
+shmring_detach(struct shmring *r)
+{
+  shmdt(r);
+}
+
+// Detach, and free the ring once no one else is attached.
+void
+shmring_destroy(struct shmring *r)
+{
+  int id;
+
+  id = r->id;
+  shmdt(r);
+  shmrm(id);
+}
+
+// Wait for a free slot and return it.
+void*
+shmring_put(struct shmring *r)
+{
+  int spins;
+
+  spins = 0;
+  while(r->tail - r->head == r->nslots){
+    if(++spins >= SHMRING_SPINS){
+      yield();
+      spins = 0;
+    }
+  }
+  barrier();
+  return slot(r, r->tail);
+}
+
+// Publish the slot returned by shmring_put(), holding n bytes.
+void
+shmring_commit(struct shmring *r, int n)
+{
+  r->len[r->tail % r->nslots] = n;
+  barrier();
+  r->tail++;
+}
+
+// Wait for a full slot and return it, with its length in *n.
+// Returns 0 once the ring is closed and empty.
+void*
+shmring_get(struct shmring *r, int *n)
+{
+  int spins;
+
+  spins = 0;
+  while(r->head == r->tail){
+    if(r->closed){
+      barrier();
+      if(r->head == r->tail)
+        return 0;
+      break;
+    }
+    if(++spins >= SHMRING_SPINS){
+      yield();
+      spins = 0;
+    }
+  }
+  barrier();
+  *n = r->len[r->head % r->nslots];
+  return slot(r, r->head);
+}
+
+// Hand the slot returned by shmring_get() back to the producer.
+void
+shmring_release(struct shmring *r)
+{
+  barrier();
+  r->head++;
+}
+
+// Tell the consumer that nothing more will be committed.
+void
+shmring_close(struct shmring *r)
+{
+  barrier();
+  r->closed = 1;
+}
@@ -0,0 +1,26 @@
+// Single-producer, single-consumer ring of fixed-size slots in a
+// shared-memory segment, to pass bulk data between processes
+// without copying it through the kernel.
+//
+// The producer fills a slot in place after shmring_put() and
+// publishes it with shmring_commit(); the consumer reads it in
+// place after shmring_get() and hands it back with
+// shmring_release(). A side waiting for the other yields the CPU.
+//
+// One process creates the ring under a key, others attach to it
+// by key or inherit it through fork(). The creator destroys it
+// when done; it is freed when the last process detaches.
+
+#define SHMRING_MAXSLOTS  256
+
+struct shmring;
+
+struct shmring* shmring_create(int key, int nslots, int slotsize);
+struct shmring* shmring_attach(int key);
+void  shmring_detach(struct shmring *r);
+void  shmring_destroy(struct shmring *r);
+void* shmring_put(struct shmring *r);
+void  shmring_commit(struct shmring *r, int n);
+void* shmring_get(struct shmring *r, int *n);
+void  shmring_release(struct shmring *r);
+void  shmring_close(struct shmring *r);
@@ -0,0 +1,226 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A cache hands out objects of one size, carved from pages
+// ("slabs") obtained from kalloc(). Each slab starts with a
+// struct slab header followed by as many objects as fit, so
+// the slab of an object is found by rounding its address down.
+// The free list link of an object is kept in a word after it,
+// not in the object itself, which holds constructed state.
+//
+// Objects are initialized by the cache's constructor once, when
+// their slab is created, and must be freed in that constructed
+// state (e.g. with their locks released), so that allocation
+// does not have to initialize them again.
+//
+// Each CPU keeps a small magazine of free objects per cache.
+// kmalloc() and kmfree() use only the local magazine in the
+// common case and move KMBATCH objects at a time between it
+// and the slabs under the cache's lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NKMCACHE   16  // maximum number of caches
+#define KMMAGSIZE  16  // objects in a per-CPU magazine
+#define KMBATCH    8   // objects moved between a magazine and slabs at once
+
+// Link to the next free object, after object v.
+#define NEXTFREE(c, v)  (*(void**)((char*)(v) + (c)->size - sizeof(void*)))
+
+struct slab {
+  struct slab *next;          // on the cache's partial or full list
+  struct slab *prev;
+  void *freelist;             // free objects in this slab
+  int inuse;                  // objects allocated from this slab
+};
+
+struct kmmag {
+  int n;
+  void *obj[KMMAGSIZE];
+};
+
+struct kmcache {
+  struct spinlock lock;       // protects everything but mag
+  char *name;
+  uint size;                  // object size, rounded up, plus link
+  int perslab;                // objects per slab
+  void (*ctor)(void*);
+  struct slab *partial;       // slabs with free objects
+  struct slab *full;          // slabs without free objects
+  int nslab;                  // number of slabs
+  struct kmmag mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct kmcache cache[NKMCACHE];
+} kmtable;
+
+void
+kminit(void)
+{
+  initlock(&kmtable.lock, "kmtable");
+}
+
+// Create a cache of objects of size bytes.
+// If ctor is not 0, it is called on each new object.
+struct kmcache*
+kmcreate(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmcache *c;
+
+  size = ((size + 3) & ~3) + sizeof(void*);
+  if(size > PGSIZE - sizeof(struct slab))
+    panic("kmcreate: size");
+
+  acquire(&kmtable.lock);
+  if(kmtable.n == NKMCACHE)
+    panic("kmcreate: too many caches");
+  c = &kmtable.cache[kmtable.n++];
+  release(&kmtable.lock);
+
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->ctor = ctor;
+  return c;
+}
+
+static void
+slabpush(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(*list)
+    (*list)->prev = s;
+  *list = s;
+}
+
+static void
+slabremove(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate a new slab for c and construct its objects.
+// Caller holds c->lock.
+static struct slab*
+slabcreate(struct kmcache *c)
+{
+  struct slab *s;
+  char *p;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->freelist = 0;
+  s->inuse = 0;
+  p = (char*)s + PGSIZE - c->perslab * c->size;
+  for(i = 0; i < c->perslab; i++, p += c->size){
+    if(c->ctor)
+      c->ctor(p);
+    NEXTFREE(c, p) = s->freelist;
+    s->freelist = p;
+  }
+  slabpush(&c->partial, s);
+  c->nslab++;
+  return s;
+}
+
+// Take an object from the slabs of c.
+// Caller holds c->lock.
+static void*
+slaballoc(struct kmcache *c)
+{
+  struct slab *s;
+  void *v;
+
+  if((s = c->partial) == 0 && (s = slabcreate(c)) == 0)
+    return 0;
+  v = s->freelist;
+  s->freelist = NEXTFREE(c, v);
+  if(++s->inuse == c->perslab){
+    slabremove(&c->partial, s);
+    slabpush(&c->full, s);
+  }
+  return v;
+}
+
+// Return object v to its slab, and the slab to
+// kalloc() if it has become empty.
+// Caller holds c->lock.
+static void
+slabfree(struct kmcache *c, void *v)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  if(s->inuse == c->perslab){
+    slabremove(&c->full, s);
+    slabpush(&c->partial, s);
+  }
+  NEXTFREE(c, v) = s->freelist;
+  s->freelist = v;
+  if(--s->inuse == 0){
+    slabremove(&c->partial, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmalloc(struct kmcache *c)
+{
+  struct kmmag *m;
+  void *v;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < KMBATCH && (v = slaballoc(c)) != 0)
+      m->obj[m->n++] = v;
+    release(&c->lock);
+  }
+  v = 0;
+  if(m->n > 0)
+    v = m->obj[--m->n];
+  popcli();
+  return v;
+}
+
+// Free object v, allocated from cache c.
+void
+kmfree(struct kmcache *c, void *v)
+{
+  struct kmmag *m;
+
+  if(PGROUNDDOWN((uint)v) == (uint)v)
+    panic("kmfree");
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == KMMAGSIZE){
+    acquire(&c->lock);
+    while(m->n > KMMAGSIZE - KMBATCH)
+      slabfree(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = v;
+  popcli();
+}
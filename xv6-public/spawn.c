@@ -0,0 +1,68 @@
+// posix_spawn(); see spawn.h.
+//
+// The file actions are turned into the map of spawn(): entry i
+// is the caller's descriptor that becomes the child's fd i.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "spawn.h"
+
+#define SPAWN_DUP2   1
+#define SPAWN_CLOSE  2
+
+int
+posix_spawn_file_actions_init(posix_spawn_file_actions_t *fa)
+{
+  fa->n = 0;
+  return 0;
+}
+
+static int
+addaction(posix_spawn_file_actions_t *fa, int op, int fd, int newfd)
+{
+  if(fa->n == SPAWN_MAXACT || fd < 0 || fd >= NOFILE || newfd < 0 || newfd >= NOFILE)
+    return -1;
+  fa->act[fa->n].op = op;
+  fa->act[fa->n].fd = fd;
+  fa->act[fa->n].newfd = newfd;
+  fa->n++;
+  return 0;
+}
+
+int
+posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *fa, int fd, int newfd)
+{
+  return addaction(fa, SPAWN_DUP2, fd, newfd);
+}
+
+int
+posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *fa, int fd)
+{
+  return addaction(fa, SPAWN_CLOSE, fd, 0);
+}
+
+// Start path with argv in a new process, whose pid is stored
+// in *pid if pid is not 0. Returns 0, or -1 on failure.
+int
+posix_spawn(int *pid, char *path, posix_spawn_file_actions_t *fa, char **argv)
+{
+  int i, n, fds[NOFILE];
+
+  for(i = 0; i < NOFILE; i++)
+    fds[i] = i;
+  for(i = 0; fa && i < fa->n; i++){
+    if(fa->act[i].op == SPAWN_DUP2){
+      if(fds[fa->act[i].fd] < 0)
+        return -1;
+      fds[fa->act[i].newfd] = fds[fa->act[i].fd];
+    } else
+      fds[fa->act[i].fd] = -1;
+  }
+  if((n = spawn(path, argv, fds, NOFILE)) < 0)
+    return -1;
+  if(pid)
+    *pid = n;
+  return 0;
+}
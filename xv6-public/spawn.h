@@ -0,0 +1,22 @@
+// posix_spawn() on top of the spawn() system call: start a
+// program in a new process without fork() copying the caller.
+//
+// File actions are applied, in order, to the descriptors the
+// child starts with, which are otherwise the caller's. There are
+// no spawn attributes and no environment.
+
+#define SPAWN_MAXACT  32
+
+typedef struct {
+  int n;
+  struct {
+    int op;
+    int fd;
+    int newfd;
+  } act[SPAWN_MAXACT];
+} posix_spawn_file_actions_t;
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *fa);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *fa, int fd, int newfd);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *fa, int fd);
+int posix_spawn(int *pid, char *path, posix_spawn_file_actions_t *fa, char **argv);
@@ -0,0 +1,78 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "spawn.h"
+
+// Compare starting a program with fork()+exec() and with
+// posix_spawn(), from a parent with a large address space.
+//
+// usage: spawnbench [megabytes]
+
+#define NRUN  100
+
+char *argv[] = { "spawnbench", "-", 0 };
+
+int
+forkexec(void)
+{
+  int pid;
+
+  pid = fork();
+  if(pid == 0){
+    exec(argv[0], argv);
+    printf(1, "panic at exec\n");
+    exit();
+  }
+  return pid;
+}
+
+int
+main(int argc, char *args[])
+{
+  int i, mb, start, ticks1, ticks2;
+  posix_spawn_file_actions_t fa;
+  char *mem;
+
+  // The program started: exit at once.
+  if(argc > 1 && args[1][0] == '-')
+    exit();
+
+  mb = 16;
+  if(argc > 1)
+    mb = atoi(args[1]);
+  if(mb < 0 || mb > 512){
+    printf(2, "usage: spawnbench [0-512]\n");
+    exit();
+  }
+  if((mem = sbrk(mb * 1024 * 1024)) == (char*)-1){
+    printf(1, "spawnbench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < mb * 256; i++)
+    mem[i * 4096] = i;
+
+  start = uptime();
+  for(i = 0; i < NRUN; i++){
+    if(forkexec() < 0){
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    wait();
+  }
+  ticks1 = uptime() - start;
+
+  posix_spawn_file_actions_init(&fa);
+  start = uptime();
+  for(i = 0; i < NRUN; i++){
+    if(posix_spawn(0, argv[0], &fa, argv) < 0){
+      printf(1, "panic at posix_spawn\n");
+      exit();
+    }
+    wait();
+  }
+  ticks2 = uptime() - start;
+
+  printf(1, "%d launches from a %dMB parent: fork+exec %d ticks, posix_spawn %d ticks\n",
+         NRUN, mb, ticks1, ticks2);
+  exit();
+}
@@ -29,8 +29,10 @@ acquire(struct spinlock *lk)
     panic("acquire");
 
   // The xchg is atomic.
+  // The lock holder may be waiting for this CPU to flush its TLB,
+  // which it cannot do by interrupt while spinning here.
   while(xchg(&lk->locked, 1) != 0)
-    ;
+    tlbflushpending();
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -1,14 +1,45 @@
 #include "types.h"
+#include "defs.h"
 #include "x86.h"
+#include "mmu.h"
+
+#define CPUID_FXSR  (1<<24)   // fxsave, fxrstor
+#define CPUID_SSE2  (1<<26)
+
+// Whether pagecopy() and pagezero() may use SSE2.
+static int usesse;
+
+// Let this CPU run SSE instructions, if it has SSE2.
+// Called on each CPU at startup, first on the boot CPU.
+void
+sseinit(void)
+{
+  if((cpuidfeatures() & (CPUID_FXSR|CPUID_SSE2)) != (CPUID_FXSR|CPUID_SSE2))
+    return;
+  lcr0((rcr0() & ~(CR0_EM|CR0_TS)) | CR0_MP);
+  lcr4(rcr4() | CR4_OSFXSR);
+  usesse = 1;
+}
 
 void*
 memset(void *dst, int c, uint n)
 {
-  if ((int)dst%4 == 0 && n%4 == 0){
-    c &= 0xFF;
-    stosl(dst, (c<<24)|(c<<16)|(c<<8)|c, n/4);
-  } else
-    stosb(dst, c, n);
+  char *d;
+  uint k;
+
+  d = dst;
+  c &= 0xFF;
+  if(n >= 16){
+    // Align the destination, then store words.
+    k = -(uint)d & 3;
+    stosb(d, c, k);
+    d += k;
+    n -= k;
+    stosl(d, (c<<24)|(c<<16)|(c<<8)|c, n/4);
+    d += n & ~3;
+    n &= 3;
+  }
+  stosb(d, c, n);
   return dst;
 }
 
@@ -33,21 +64,105 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  uint k;
 
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // Overlapping, with dst above src: copy down from the end.
     s += n;
     d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else
-    while(n-- > 0)
-      *d++ = *s++;
-
+    while(n % 4)
+      *--d = *--s, n--;
+    if(n > 0)
+      asm volatile("std; rep movsl; cld" :
+                   "=D" (d), "=S" (s), "=c" (n) :
+                   "0" (d - 4), "1" (s - 4), "2" (n / 4) :
+                   "memory", "cc");
+    return dst;
+  }
+  if(n >= 16){
+    // Align the destination, then move words.
+    k = -(uint)d & 3;
+    movsb(d, s, k);
+    d += k;
+    s += k;
+    n -= k;
+    movsl(d, s, n/4);
+    d += n & ~3;
+    s += n & ~3;
+    n &= 3;
+  }
+  movsb(d, s, n);
   return dst;
 }
 
+// Copy the page at src to the page at dst. With SSE2 the page is
+// moved 64 bytes at a time, with non-temporal stores: the copy
+// does not evict what the caches hold for the code that faulted,
+// and lines of dst are not read first only to be overwritten.
+// The %xmm registers belong to the current process, so the ones
+// used are saved and restored, with interrupts off in between so
+// that no other process runs on this CPU meanwhile.
+void
+pagecopy(void *dst, const void *src)
+{
+  char save[64];
+  char *d, *s;
+
+  if(!usesse){
+    memmove(dst, src, PGSIZE);
+    return;
+  }
+  pushcli();
+  asm volatile("movdqu %%xmm0, 0(%0)\n\t"
+               "movdqu %%xmm1, 16(%0)\n\t"
+               "movdqu %%xmm2, 32(%0)\n\t"
+               "movdqu %%xmm3, 48(%0)" : : "r" (save) : "memory");
+  for(d = dst, s = (char*)src; d < (char*)dst + PGSIZE; d += 64, s += 64)
+    asm volatile("movdqa 0(%1), %%xmm0\n\t"
+                 "movdqa 16(%1), %%xmm1\n\t"
+                 "movdqa 32(%1), %%xmm2\n\t"
+                 "movdqa 48(%1), %%xmm3\n\t"
+                 "movntdq %%xmm0, 0(%0)\n\t"
+                 "movntdq %%xmm1, 16(%0)\n\t"
+                 "movntdq %%xmm2, 32(%0)\n\t"
+                 "movntdq %%xmm3, 48(%0)" : : "r" (d), "r" (s) : "memory");
+  // Non-temporal stores are weakly ordered.
+  asm volatile("sfence" : : : "memory");
+  asm volatile("movdqu 0(%0), %%xmm0\n\t"
+               "movdqu 16(%0), %%xmm1\n\t"
+               "movdqu 32(%0), %%xmm2\n\t"
+               "movdqu 48(%0), %%xmm3" : : "r" (save) : "memory");
+  popcli();
+}
+
+// Fill the page at dst with zeros, with non-temporal stores if
+// possible. For pages that will not be used right away; see
+// pagecopy().
+void
+pagezero(void *dst)
+{
+  char save[16];
+  char *d;
+
+  if(!usesse){
+    memset(dst, 0, PGSIZE);
+    return;
+  }
+  pushcli();
+  asm volatile("movdqu %%xmm0, (%0)\n\t"
+               "pxor %%xmm0, %%xmm0" : : "r" (save) : "memory");
+  for(d = dst; d < (char*)dst + PGSIZE; d += 64)
+    asm volatile("movntdq %%xmm0, 0(%0)\n\t"
+                 "movntdq %%xmm0, 16(%0)\n\t"
+                 "movntdq %%xmm0, 32(%0)\n\t"
+                 "movntdq %%xmm0, 48(%0)" : : "r" (d) : "memory");
+  asm volatile("sfence" : : : "memory");
+  asm volatile("movdqu (%0), %%xmm0" : : "r" (save) : "memory");
+  popcli();
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void*
 memcpy(void *dst, const void *src, uint n)
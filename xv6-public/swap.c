@@ -0,0 +1,153 @@
+// Swap area.
+//
+// mkfs reserves SWAPSIZE blocks after the file system for
+// pages that the clock in vm.c evicts from user memory. A
+// swapped-out page's PTE holds the number of its page-sized
+// slot here (see PTE_SWAP). A slot is referenced by each PTE
+// holding it, as fork() copies them, and is free when the last
+// one is dropped.
+//
+// Pages go to and from the disk without the buffer cache,
+// which would only lose file blocks to them, one block at a
+// time through a private buf.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define BPP     (PGSIZE/BSIZE)    // blocks per page
+#define NSLOT   (SWAPSIZE/BPP)    // most slots in a swap area
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;              // first block of the swap area
+  int nslot;               // 0 if there is no swap area
+  int nfree;
+  int next;                // where to look for a free slot
+  ushort ref[NSLOT];       // PTEs and swap-ins holding each slot
+} swap;
+
+// For swapread() and swapwrite(); its lock serializes them.
+static struct buf swapbuf;
+
+// Find the swap area of the file system on dev.
+// Must be called in process context, after iinit().
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swapbuf.lock, "swapbuf");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / BPP;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  swap.nfree = swap.nslot;
+  cprintf("swap: %d pages\n", swap.nslot);
+}
+
+// Allocate a slot, with one reference.
+// Returns -1 if the swap area is full.
+int
+swapalloc(void)
+{
+  int i, slot;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    slot = (swap.next + i) % swap.nslot;
+    if(swap.ref[slot] == 0){
+      swap.ref[slot] = 1;
+      swap.nfree--;
+      swap.next = slot + 1;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Take another reference to slot.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+// Read or write page mem from or to slot.
+static void
+swaprw(char *mem, uint slot, int write)
+{
+  int i;
+
+  acquiresleep(&swapbuf.lock);
+  for(i = 0; i < BPP; i++){
+    swapbuf.dev = swap.dev;
+    swapbuf.blockno = swap.start + slot*BPP + i;
+    if(write){
+      memmove(swapbuf.data, mem + i*BSIZE, BSIZE);
+      swapbuf.flags = B_DIRTY;
+      iderw(&swapbuf);
+    } else {
+      swapbuf.flags = 0;
+      iderw(&swapbuf);
+      memmove(mem + i*BSIZE, swapbuf.data, BSIZE);
+    }
+  }
+  releasesleep(&swapbuf.lock);
+}
+
+void
+swapread(char *mem, uint slot)
+{
+  swaprw(mem, slot, 0);
+}
+
+void
+swapwrite(char *mem, uint slot)
+{
+  swaprw(mem, slot, 1);
+}
+
+void
+swapstat(struct memstat *ms)
+{
+  acquire(&swap.lock);
+  ms->swaptotal = swap.nslot;
+  ms->swapused = swap.nslot - swap.nfree;
+  release(&swap.lock);
+}
+
+// Print how much swap is in use. For debugging; runs on ^P.
+void
+swapdump(void)
+{
+  cprintf("swap: %d of %d pages used\n", swap.nslot - swap.nfree, swap.nslot);
+}
@@ -0,0 +1,97 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Test page reclaim: touch more memory than the machine has
+// (qemu runs with 512MB), so that pages go to swap and come back
+// on the next access, and fork while pages are on swap.
+//
+// usage: swaptest [megabytes]
+
+#define PGSIZE  4096
+#define NCHILD  (16 * 256)   // pages the fork child checks
+
+char *mem;
+int npages;
+
+void
+test1()
+{
+  int i, start;
+
+  // Every page keeps its contents through swap.
+  start = uptime();
+  for(i = 0; i < npages; i++)
+    *(int*)(mem + i * PGSIZE) = i;
+  printf(1, "wrote %d pages in %d ticks\n", npages, uptime() - start);
+
+  start = uptime();
+  for(i = 0; i < npages; i++){
+    if(*(int*)(mem + i * PGSIZE) != i){
+      printf(1, "panic at test1: page %d is %d\n", i, *(int*)(mem + i * PGSIZE));
+      return;
+    }
+  }
+  printf(1, "read back %d pages in %d ticks\n", npages, uptime() - start);
+  printf(1, "Test 1 is done!\n");
+}
+
+void
+test2()
+{
+  int i, pid;
+
+  // A child shares the parent's pages, also those on swap,
+  // copy-on-write.
+  pid = fork();
+  if(pid < 0){
+    printf(1, "panic at fork\n");
+    return;
+  }
+  if(pid == 0){
+    for(i = 0; i < NCHILD && i < npages; i++){
+      if(*(int*)(mem + i * PGSIZE) != i){
+        printf(1, "panic at test2 (child): page %d\n", i);
+        exit();
+      }
+      *(int*)(mem + i * PGSIZE) = -1;
+    }
+    exit();
+  }
+  wait();
+  for(i = 0; i < npages; i++){
+    if(*(int*)(mem + i * PGSIZE) != i){
+      printf(1, "panic at test2: page %d is %d\n", i, *(int*)(mem + i * PGSIZE));
+      return;
+    }
+  }
+  printf(1, "Test 2 is done!\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb;
+
+  mb = 528;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1 || mb > 1000){
+    printf(2, "usage: swaptest [1-1000]\n");
+    exit();
+  }
+  npages = mb * 256;
+  if((mem = sbrk(npages * PGSIZE)) == (char*)-1){
+    printf(1, "swaptest: sbrk failed\n");
+    exit();
+  }
+
+  printf(1, "===========Test1===========\n");
+  test1();
+
+  printf(1, "===========Test2===========\n");
+  test2();
+
+  printf(1, "All tests are done\n");
+  exit();
+}
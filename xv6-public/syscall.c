@@ -6,6 +6,8 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "spinlock.h"
+#include "vm.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -17,9 +19,7 @@
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
-
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(checkuva(addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -28,21 +28,23 @@ fetchint(uint addr, int *ip)
 // Fetch the nul-terminated string at addr from the current process.
 // Doesn't actually copy the string - just sets *pp to point at it.
 // Returns length of string, not including nul.
+// Each page is checked and faulted in by checkuva() before it
+// is searched, as for argptr().
 int
 fetchstr(uint addr, char **pp)
 {
-  char *s, *ep;
-  struct proc *curproc = myproc();
+  char *s;
+  uint a, n;
 
-  if(addr >= curproc->sz)
-    return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  for(a = addr; ; a += n){
+    n = PGSIZE - a % PGSIZE;
+    if(checkuva(a, n, 0) < 0)
+      return -1;
+    for(s = (char*)a; s < (char*)a + n; s++)
+      if(*s == 0)
+        return s - *pp;
   }
-  return -1;
 }
 
 // Fetch the nth 32-bit system call argument.
@@ -52,23 +54,36 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
-  struct proc *curproc = myproc();
- 
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || checkuva(i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
+// Like argptr, for a block of memory that the system call
+// writes to, which must not be a read-only mmap() region.
+int
+argout(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -114,6 +129,19 @@ extern int sys_thread_join(void);
 extern int sys_gettid(void);
 extern int sys_pread(void);
 extern int sys_pwrite(void);
+extern int sys_thread_join_any(void);
+extern int sys_thread_detach(void);
+extern int sys_fcntl(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_shmrm(void);
+extern int sys_spawn(void);
+extern int sys_memstat(void);
+extern int sys_procmem(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -148,6 +176,19 @@ static int (*syscalls[])(void) = {
 [SYS_gettid] sys_gettid,
 [SYS_pread] sys_pread,
 [SYS_pwrite] sys_pwrite,
+[SYS_thread_join_any] sys_thread_join_any,
+[SYS_thread_detach] sys_thread_detach,
+[SYS_fcntl] sys_fcntl,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_msync] sys_msync,
+[SYS_shmget] sys_shmget,
+[SYS_shmat] sys_shmat,
+[SYS_shmdt] sys_shmdt,
+[SYS_shmrm] sys_shmrm,
+[SYS_spawn] sys_spawn,
+[SYS_memstat] sys_memstat,
+[SYS_procmem] sys_procmem,
 };
 
 void
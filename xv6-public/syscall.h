@@ -31,3 +31,16 @@
 #define SYS_gettid 30
 #define SYS_pread 31
 #define SYS_pwrite 32
+#define SYS_thread_join_any 33
+#define SYS_thread_detach 34
+#define SYS_fcntl 35
+#define SYS_mmap 36
+#define SYS_munmap 37
+#define SYS_msync 38
+#define SYS_shmget 39
+#define SYS_shmat 40
+#define SYS_shmdt 41
+#define SYS_shmrm 42
+#define SYS_spawn 43
+#define SYS_memstat 44
+#define SYS_procmem 45
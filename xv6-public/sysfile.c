@@ -7,6 +7,7 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "stat.h"
 #include "mmu.h"
 #include "proc.h"
@@ -15,6 +16,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +28,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f=fdget(&myproc()->fdt, fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -35,23 +37,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-  struct proc *curproc = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 int
 sys_dup(void)
 {
@@ -60,7 +45,7 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(&myproc()->fdt, f)) < 0)
     return -1;
   filedup(f);
   return fd;
@@ -73,7 +58,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argout(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -98,7 +83,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdremove(&myproc()->fdt, fd);
   fileclose(f);
   return 0;
 }
@@ -109,7 +94,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argout(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -315,7 +300,7 @@ sys_open(void)
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
+  if((f = filealloc()) == 0 || (fd = fdalloc(&myproc()->fdt, f)) < 0){
     if(f)
       fileclose(f);
     iunlockput(ip);
@@ -330,6 +315,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   return fd;
 }
 
@@ -394,19 +380,19 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the nth word-sized system call argument as an
+// argument vector of at most MAXARG strings.
+static int
+argargv(int n, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argint(n, (int*)&uargv) < 0)
     return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -417,9 +403,37 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0){
+    return -1;
+  }
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int *fds, nfd;
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0 || argint(3, &nfd) < 0)
+    return -1;
+  if(nfd < 0 || nfd > KERNBASE/sizeof(fds[0]))
+    return -1;
+  if(argint(2, (int*)&fds) < 0)
+    return -1;
+  if(fds && argptr(2, (void*)&fds, nfd*sizeof(fds[0])) < 0)
+    return -1;
+  return spawn(path, argv, fds, nfd);
+}
+
 int
 sys_pipe(void)
 {
@@ -427,14 +441,14 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argout(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
-  if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
+  if((fd0 = fdalloc(&myproc()->fdt, rf)) < 0 || (fd1 = fdalloc(&myproc()->fdt, wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdremove(&myproc()->fdt, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -452,7 +466,7 @@ sys_pread(void)
   char *p;
   int off;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0 || argout(1, &p, n) < 0)
     return -1;
   return pfileread(f, p, n, off);
 }
@@ -470,3 +484,81 @@ sys_pwrite(void)
   return pfilewrite(f, p, n, off);
 }
 
+// Get or set the file status flags of a descriptor.
+// Only O_NONBLOCK can be changed.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg, flags;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    if(f->readable && f->writable)
+      flags = O_RDWR;
+    else if(f->writable)
+      flags = O_WRONLY;
+    else
+      flags = O_RDONLY;
+    if(f->nonblock)
+      flags |= O_NONBLOCK;
+    return flags;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Map a file, or zeroed memory with MAP_ANON, into memory.
+// The address hint is ignored: the region is placed at the
+// lowest free address above MMAPBASE.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int addr, len, prot, flags, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if((flags & MAP_HUGE) && (flags & (MAP_SHARED|MAP_ANON)) != (MAP_SHARED|MAP_ANON))
+    return -1;
+  f = 0;
+  if((flags & MAP_ANON) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  return mmap(myproc()->vm, PGROUNDUP(len), prot, flags, f, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(myproc()->vm, addr, addr + PGROUNDUP(len));
+}
+
+// Write the dirty pages of shared file mappings
+// in a range back to their files.
+int
+sys_msync(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len < 0)
+    return -1;
+  msync(myproc()->vm, addr, addr + len);
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "memstat.h"
 
 int
 sys_fork(void)
@@ -119,10 +120,11 @@ int sys_set_cpu_share(void)
 // Create Thread
 int sys_thread_create(void)
 {
-  int thread, routine, arg;
+  thread_t *thread;
+  int routine, arg;
   //void* (*routine_p)(void*);
 
-  if(argint(0, &thread) < 0)
+  if(argout(0, (void*)&thread, sizeof(*thread)) < 0)
     return -1;
 
   if(argint(1, &routine) < 0)
@@ -132,7 +134,7 @@ int sys_thread_create(void)
     return -1;
 
   //routine_p = (void*)routine;
-  return thread_create((thread_t*)thread, (void*)routine, (void*)arg);
+  return thread_create(thread, (void*)routine, (void*)arg);
 }
 
 // Exit thread
@@ -150,15 +152,42 @@ int sys_thread_exit(void)
 // Join thread
 int sys_thread_join(void)
 {
-  int thread, retval;
+  int thread;
+  void **retval;
 
   if(argint(0, &thread) < 0)
     return -1;
 
-  if(argint(1, &retval) < 0)
+  if(argout(1, (void*)&retval, sizeof(*retval)) < 0)
+    return -1;
+
+  return thread_join((thread_t)thread, retval);
+}
+
+// Join any thread that has exited
+int sys_thread_join_any(void)
+{
+  thread_t *thread;
+  void **retval;
+
+  if(argout(0, (void*)&thread, sizeof(*thread)) < 0)
+    return -1;
+
+  if(argout(1, (void*)&retval, sizeof(*retval)) < 0)
+    return -1;
+
+  return thread_join_any(thread, retval);
+}
+
+// Detach thread
+int sys_thread_detach(void)
+{
+  int thread;
+
+  if(argint(0, &thread) < 0)
     return -1;
-    
-  return thread_join((thread_t)thread, (void**)retval);
+
+  return thread_detach((thread_t)thread);
 }
 
 int
@@ -167,4 +196,71 @@ sys_gettid(void)
   return myproc()->tid;
 }
 
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(myproc()->vm, id);
+}
 
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(myproc()->vm, addr);
+}
+
+int
+sys_shmrm(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmrm(id);
+}
+
+int
+sys_memstat(void)
+{
+  struct memstat *ums, ms;
+
+  if(argout(0, (void*)&ums, sizeof(*ums)) < 0)
+    return -1;
+  memset(&ms, 0, sizeof(ms));
+  kallocstat(&ms);
+  swapstat(&ms);
+  textstat(&ms);
+  bstat(&ms);
+  *ums = ms;
+  return 0;
+}
+
+int
+sys_procmem(void)
+{
+  struct procmem *pm;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || n > KERNBASE/sizeof(*pm))
+    return -1;
+  if(argout(0, (void*)&pm, n*sizeof(*pm)) < 0)
+    return -1;
+  return procmem(pm, n);
+}
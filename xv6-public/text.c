@@ -0,0 +1,194 @@
+// Text cache.
+//
+// Processes running the same program share the pages of its
+// image: pagefault() takes each whole page of a private file
+// region from here instead of reading a copy of its own, and maps
+// it copy-on-write. An image is named by its inode (dev, inum) and
+// by where its pages start in the file modulo PGSIZE, since ELF
+// segments need not be page-aligned in the file.
+//
+// A page holds one reference for the cache plus one for each page
+// table it is mapped in. Writing or truncating the file drops its
+// images; mappings keep their pages, so running processes go on
+// with the old program. Under memory pressure reclaim() frees the
+// pages no process maps, and a new image takes the slot of the
+// least recently used one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "memstat.h"
+
+#define NTEXT      16                     // maximum number of images
+#define TEXTMAXPG  (PGSIZE/sizeof(uint))  // maximum pages in an image
+
+struct text {
+  uint dev;         // 0 if this slot is free
+  uint inum;
+  uint skew;        // file offset of the pages, modulo PGSIZE
+  uint used;        // textcache.clock at the last hit
+  uint *pages;      // physical address of each page, or 0
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  uint gen;         // bumped when images are dropped
+  uint npages;      // pages cached
+  struct text text[NTEXT];
+} textcache;
+
+void
+textinit(void)
+{
+  initlock(&textcache.lock, "text");
+}
+
+// Drop image t. Caller holds textcache.lock.
+static void
+textfree(struct text *t)
+{
+  int i;
+
+  for(i = 0; i < TEXTMAXPG; i++){
+    if(t->pages[i]){
+      kfree(P2V(t->pages[i]));
+      textcache.npages--;
+    }
+  }
+  kfree((char*)t->pages);
+  memset(t, 0, sizeof(*t));
+  textcache.gen++;
+}
+
+// Find the image of ip at skew, creating it in a free or the
+// least recently used slot if create is set.
+// Returns 0 if there is none. Caller holds textcache.lock.
+static struct text*
+textget(struct inode *ip, uint skew, int create)
+{
+  struct text *t, *victim;
+
+  victim = 0;
+  for(t = textcache.text; t < &textcache.text[NTEXT]; t++){
+    if(t->dev == ip->dev && t->inum == ip->inum && t->skew == skew)
+      return t;
+    if(victim == 0 || (victim->dev != 0 && (t->dev == 0 || t->used < victim->used)))
+      victim = t;
+  }
+  if(!create)
+    return 0;
+  if(victim->dev != 0)
+    textfree(victim);
+  if((victim->pages = (uint*)kalloc_zeroed()) == 0)
+    return 0;
+  victim->dev = ip->dev;
+  victim->inum = ip->inum;
+  victim->skew = skew;
+  victim->used = ++textcache.clock;
+  return victim;
+}
+
+// Return the page of ip at file offset off, zeroed past the end
+// of the file, with a reference taken for the caller's page table.
+// The page is shared and must be mapped read-only. Caller must
+// not hold ip->lock. Returns 0 if out of memory.
+char*
+textpage(struct inode *ip, uint off)
+{
+  struct text *t;
+  uint i, gen;
+  char *mem;
+
+  i = off / PGSIZE;
+  acquire(&textcache.lock);
+  if(i < TEXTMAXPG && (t = textget(ip, off % PGSIZE, 0)) != 0 && t->pages[i]){
+    t->used = ++textcache.clock;
+    mem = P2V(t->pages[i]);
+    kref(mem);
+    release(&textcache.lock);
+    return mem;
+  }
+  gen = textcache.gen;
+  release(&textcache.lock);
+
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  ilock(ip);
+  readi(ip, mem, off, PGSIZE);
+  iunlock(ip);
+  if(i >= TEXTMAXPG)
+    return mem;
+
+  // Cache the page unless the file may have changed meanwhile.
+  acquire(&textcache.lock);
+  if(textcache.gen == gen && (t = textget(ip, off % PGSIZE, 1)) != 0){
+    if(t->pages[i]){
+      // Another process read it first.
+      kfree(mem);
+      mem = P2V(t->pages[i]);
+    } else {
+      t->pages[i] = V2P(mem);
+      textcache.npages++;
+    }
+    kref(mem);
+  }
+  release(&textcache.lock);
+  return mem;
+}
+
+// The contents of ip are about to change: drop its images.
+// gen changes even if there are none, so that a page of ip being
+// read by textpage() meanwhile is not cached.
+void
+textinval(struct inode *ip)
+{
+  struct text *t;
+
+  acquire(&textcache.lock);
+  textcache.gen++;
+  for(t = textcache.text; t < &textcache.text[NTEXT]; t++)
+    if(t->dev == ip->dev && t->inum == ip->inum)
+      textfree(t);
+  release(&textcache.lock);
+}
+
+// Free up to n cached pages that no process maps.
+// Returns the number of pages freed.
+int
+textshrink(int n)
+{
+  struct text *t;
+  int i, freed;
+
+  freed = 0;
+  acquire(&textcache.lock);
+  for(t = textcache.text; t < &textcache.text[NTEXT] && freed < n; t++){
+    if(t->dev == 0)
+      continue;
+    for(i = 0; i < TEXTMAXPG && freed < n; i++){
+      if(t->pages[i] && krefcount(P2V(t->pages[i])) == 1){
+        kfree(P2V(t->pages[i]));
+        t->pages[i] = 0;
+        textcache.npages--;
+        freed++;
+      }
+    }
+  }
+  release(&textcache.lock);
+  return freed;
+}
+
+void
+textstat(struct memstat *ms)
+{
+  acquire(&textcache.lock);
+  ms->text = textcache.npages;
+  release(&textcache.lock);
+}
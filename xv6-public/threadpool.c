@@ -0,0 +1,422 @@
+// Work-stealing thread pool.
+//
+// Each worker owns a Chase-Lev deque: the owner pushes and takes
+// at the bottom without atomic instructions in the common case,
+// and thieves race for the top with cmpxchg. See
+// "Dynamic Circular Work-Stealing Deque" (Chase and Lev, SPAA 2005).
+// The deque here has a fixed size; a task that does not fit is
+// simply run by the spawning worker.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "threadpool.h"
+
+#define TP_SPINS 64   // failed steal attempts before giving up the CPU
+
+struct tpdeque {
+  volatile uint top;       // next slot thieves steal from
+  volatile uint bottom;    // next slot owner pushes to
+  struct tptask *volatile buf[TP_DEQUESIZE];
+};
+
+struct tpworker {
+  struct tpdeque dq;
+  thread_t thread;
+  char *stack;             // bottom of this worker's user stack
+  uint seed;               // to choose victim when stealing
+};
+
+static struct {
+  int nworkers;
+  struct tpworker *workers[TP_MAXWORKERS];
+  volatile uint inject;    // task submitted from outside by tp_run()
+  volatile uint shutdown;
+} tp;
+
+// Push t at the bottom of the deque. Only the owner calls this.
+// Returns -1 if the deque is full.
+static int
+dq_push(struct tpdeque *dq, struct tptask *t)
+{
+  uint b;
+
+  b = dq->bottom;
+  if(b - dq->top >= TP_DEQUESIZE)
+    return -1;
+  dq->buf[b % TP_DEQUESIZE] = t;
+  // x86 does not reorder stores, so a thief that
+  // sees the new bottom also sees the task.
+  dq->bottom = b + 1;
+  return 0;
+}
+
+// Take the newest task from the bottom of the deque.
+// Only the owner calls this.
+static struct tptask*
+dq_take(struct tpdeque *dq)
+{
+  uint b, t;
+  struct tptask *task;
+
+  b = dq->bottom - 1;
+  // xchg is a full fence, so the load of top below
+  // cannot be done before bottom is published.
+  xchg(&dq->bottom, b);
+  t = dq->top;
+  if((int)(b - t) < 0){
+    // Empty.
+    dq->bottom = b + 1;
+    return 0;
+  }
+  task = dq->buf[b % TP_DEQUESIZE];
+  if(b == t){
+    // Last task: race with thieves for it.
+    if(cmpxchg(&dq->top, t, t + 1) != t)
+      task = 0;
+    dq->bottom = b + 1;
+  }
+  return task;
+}
+
+// Steal the oldest task from the top of someone else's deque.
+static struct tptask*
+dq_steal(struct tpdeque *dq)
+{
+  uint t, b;
+  struct tptask *task;
+
+  t = dq->top;
+  b = dq->bottom;
+  if((int)(b - t) <= 0)
+    return 0;
+  task = dq->buf[t % TP_DEQUESIZE];
+  if(cmpxchg(&dq->top, t, t + 1) != t)
+    return 0;
+  return task;
+}
+
+// Return the worker whose stack we are running on,
+// or 0 if the caller is not a worker of the pool.
+static struct tpworker*
+curworker(void)
+{
+  uint esp;
+  int i;
+
+  asm volatile("movl %%esp, %0" : "=r" (esp));
+  for(i = 0; i < tp.nworkers; i++)
+    if(esp - (uint)tp.workers[i]->stack < TP_STACKSIZE)
+      return tp.workers[i];
+  return 0;
+}
+
+static void
+runtask(struct tptask *t)
+{
+  t->fn(t->arg);
+  t->done = 1;
+}
+
+// Find a task that is not on w's own deque:
+// a task submitted by tp_run(), or one stolen from other workers.
+static struct tptask*
+steal(struct tpworker *w)
+{
+  struct tptask *t;
+  int i, victim;
+
+  if(tp.inject && (t = (struct tptask*)xchg(&tp.inject, 0)) != 0)
+    return t;
+
+  for(i = 0; i < tp.nworkers; i++){
+    w->seed = w->seed * 1103515245 + 12345;
+    victim = (w->seed >> 16) % tp.nworkers;
+    if(tp.workers[victim] == w)
+      continue;
+    if((t = dq_steal(&tp.workers[victim]->dq)) != 0)
+      return t;
+  }
+  return 0;
+}
+
+static void
+workerloop(struct tpworker *w)
+{
+  struct tptask *t;
+  int idle;
+
+  idle = 0;
+  while(!tp.shutdown){
+    if((t = dq_take(&w->dq)) != 0 || (t = steal(w)) != 0){
+      runtask(t);
+      idle = 0;
+    } else if(++idle >= TP_SPINS){
+      // No work anywhere; let other processes run.
+      yield();
+      idle = 0;
+    }
+  }
+  thread_exit(0);
+}
+
+static void*
+workerstart(void *arg)
+{
+  struct tpworker *w = arg;
+
+  // The stack thread_create() gives us is a single page,
+  // too small for recursive tasks. Move to the worker's own.
+  asm volatile("movl %0, %%esp\n\t"
+               "pushl %1\n\t"
+               "call *%2"
+               : : "r" (w->stack + TP_STACKSIZE), "r" (w), "r" (workerloop)
+               : "memory");
+  return 0;  // not reached
+}
+
+// Stop the first nthreads workers and free all of them.
+static void
+teardown(int nthreads)
+{
+  struct tpworker *w;
+  void *retval;
+  int i;
+
+  tp.shutdown = 1;
+  for(i = 0; i < nthreads; i++)
+    thread_join(tp.workers[i]->thread, &retval);
+
+  for(i = 0; i < tp.nworkers; i++){
+    w = tp.workers[i];
+    if(w->stack)
+      free(w->stack);
+    free(w);
+    tp.workers[i] = 0;
+  }
+  tp.nworkers = 0;
+}
+
+// Start a pool of nworkers threads.
+// Returns 0 on success, -1 on failure.
+int
+tp_init(int nworkers)
+{
+  struct tpworker *w;
+  int i;
+
+  if(nworkers < 1 || nworkers > TP_MAXWORKERS || tp.nworkers)
+    return -1;
+
+  tp.shutdown = 0;
+  tp.inject = 0;
+
+  // Allocate everything before any worker runs,
+  // so that a failure is undone with no worker to stop.
+  for(tp.nworkers = 0; tp.nworkers < nworkers; tp.nworkers++){
+    if((w = malloc(sizeof(*w))) == 0){
+      teardown(0);
+      return -1;
+    }
+    memset(w, 0, sizeof(*w));
+    w->seed = tp.nworkers + 1;
+    tp.workers[tp.nworkers] = w;
+    if((w->stack = malloc(TP_STACKSIZE)) == 0){
+      tp.nworkers++;
+      teardown(0);
+      return -1;
+    }
+  }
+
+  for(i = 0; i < nworkers; i++){
+    w = tp.workers[i];
+    if(thread_create(&w->thread, workerstart, w) != 0){
+      teardown(i);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Wait for all workers to exit and free the pool.
+void
+tp_exit(void)
+{
+  teardown(tp.nworkers);
+}
+
+// Run fn(arg) on the pool and wait for it to finish.
+// If called by a worker or without a pool, fn runs in the caller.
+void
+tp_run(void (*fn)(void*), void *arg)
+{
+  struct tptask t;
+
+  if(tp.nworkers == 0 || curworker() != 0){
+    fn(arg);
+    return;
+  }
+
+  t.fn = fn;
+  t.arg = arg;
+  t.done = 0;
+  // yield() rather than sleep(1), which would add up to a
+  // tick of latency to every call.
+  while(cmpxchg(&tp.inject, 0, (uint)&t) != 0)
+    yield();
+  while(!t.done)
+    yield();
+}
+
+// Make fn(arg) available to other workers.
+// t must stay valid until tp_sync(t) returns.
+void
+tp_spawn(struct tptask *t, void (*fn)(void*), void *arg)
+{
+  struct tpworker *w;
+
+  t->fn = fn;
+  t->arg = arg;
+  t->done = 0;
+
+  // Run it right now if there is no room for it.
+  w = curworker();
+  if(w == 0 || dq_push(&w->dq, t) < 0)
+    runtask(t);
+}
+
+// Wait for a task started by tp_spawn() to finish.
+void
+tp_sync(struct tptask *t)
+{
+  struct tpworker *w;
+  struct tptask *x;
+  int idle;
+
+  if(t->done)
+    return;
+
+  // Common case: nobody stole t, and it is still
+  // at the bottom of our deque. Run it ourselves.
+  w = curworker();
+  if((x = dq_take(&w->dq)) != 0){
+    if(x == t){
+      runtask(t);
+      return;
+    }
+    dq_push(&w->dq, x);
+  }
+
+  // t was stolen. Help other workers until the thief finishes it.
+  idle = 0;
+  while(!t->done){
+    if((x = steal(w)) != 0){
+      runtask(x);
+      idle = 0;
+    } else if(++idle >= TP_SPINS){
+      yield();
+      idle = 0;
+    }
+  }
+}
+
+struct forarg {
+  int lo, hi, grain;
+  void (*body)(int, int, void*);
+  void *arg;
+};
+
+static void
+forrange(void *p)
+{
+  struct forarg *a = p;
+  struct forarg left, right;
+  struct tptask t;
+  int mid;
+
+  if(a->hi - a->lo <= a->grain){
+    a->body(a->lo, a->hi, a->arg);
+    return;
+  }
+
+  mid = a->lo + (a->hi - a->lo) / 2;
+  left = right = *a;
+  left.hi = mid;
+  right.lo = mid;
+  tp_spawn(&t, forrange, &left);
+  forrange(&right);
+  tp_sync(&t);
+}
+
+// Call body(lo', hi', arg) for subranges of [lo, hi)
+// no larger than grain, in parallel.
+void
+tp_parallel_for(int lo, int hi, int grain,
+                void (*body)(int, int, void*), void *arg)
+{
+  struct forarg a;
+
+  if(grain < 1)
+    grain = 1;
+  a.lo = lo;
+  a.hi = hi;
+  a.grain = grain;
+  a.body = body;
+  a.arg = arg;
+  tp_run(forrange, &a);
+}
+
+struct reducearg {
+  int lo, hi, grain;
+  int (*map)(int, int, void*);
+  int (*combine)(int, int);
+  void *arg;
+  int result;
+};
+
+static void
+reducerange(void *p)
+{
+  struct reducearg *a = p;
+  struct reducearg left, right;
+  struct tptask t;
+  int mid;
+
+  if(a->hi - a->lo <= a->grain){
+    a->result = a->map(a->lo, a->hi, a->arg);
+    return;
+  }
+
+  mid = a->lo + (a->hi - a->lo) / 2;
+  left = right = *a;
+  left.hi = mid;
+  right.lo = mid;
+  tp_spawn(&t, reducerange, &left);
+  reducerange(&right);
+  tp_sync(&t);
+  a->result = a->combine(left.result, right.result);
+}
+
+// Compute map(lo', hi', arg) for subranges of [lo, hi)
+// no larger than grain in parallel, and fold the results
+// with combine. [lo, hi) must not be empty.
+int
+tp_reduce(int lo, int hi, int grain,
+          int (*map)(int, int, void*), int (*combine)(int, int),
+          void *arg)
+{
+  struct reducearg a;
+
+  if(grain < 1)
+    grain = 1;
+  a.lo = lo;
+  a.hi = hi;
+  a.grain = grain;
+  a.map = map;
+  a.combine = combine;
+  a.arg = arg;
+  a.result = 0;
+  tp_run(reducerange, &a);
+  return a.result;
+}
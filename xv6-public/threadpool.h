@@ -0,0 +1,31 @@
+// Work-stealing thread pool on top of thread_create().
+//
+// A fixed set of LWP workers, each with its own Chase-Lev deque.
+// Workers push and pop tasks at the bottom of their own deque,
+// and idle workers steal from the top of the others.
+//
+// tp_spawn() and tp_sync() may only be called from code that is
+// already running on a worker (inside a task). Code outside the
+// pool (e.g. main) submits work with tp_run(), or with
+// tp_parallel_for() / tp_reduce() which call tp_run() if needed.
+
+#define TP_MAXWORKERS   8
+#define TP_DEQUESIZE    1024       // tasks per worker deque (power of 2)
+#define TP_STACKSIZE    (64*1024)  // user stack of each worker
+
+struct tptask {
+  void (*fn)(void*);
+  void *arg;
+  volatile uint done;    // set when fn has returned
+};
+
+int  tp_init(int nworkers);
+void tp_exit(void);
+void tp_run(void (*fn)(void*), void *arg);
+void tp_spawn(struct tptask *t, void (*fn)(void*), void *arg);
+void tp_sync(struct tptask *t);
+void tp_parallel_for(int lo, int hi, int grain,
+                     void (*body)(int, int, void*), void *arg);
+int  tp_reduce(int lo, int hi, int grain,
+               int (*map)(int, int, void*), int (*combine)(int, int),
+               void *arg);
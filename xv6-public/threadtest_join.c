@@ -0,0 +1,110 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 10
+
+// Test thread_join_any and thread_detach
+
+void*
+sleeper(void *arg)
+{
+  int n = (int) arg;
+
+  // Thread with higher n exits later
+  sleep(n * 5);
+  thread_exit((void *)(n+1));
+}
+
+void
+test1()
+{
+  thread_t threads[NUM_THREAD];
+  thread_t tid;
+  int i;
+  void *retval;
+
+  // Create in reversed order, so that completion order
+  // differs from creation order
+  for (i = 0; i < NUM_THREAD; i++){
+    if (thread_create(&threads[i], sleeper, (void*)(NUM_THREAD - 1 - i)) != 0){
+      printf(1, "panic at thread_create\n");
+      return;
+    }
+  }
+
+  for (i = 0; i < NUM_THREAD; i++){
+    if (thread_join_any(&tid, &retval) != 0){
+      printf(1, "panic at thread_join_any\n");
+      return;
+    }
+    if ((int)retval != i+1){
+      printf(1, "panic at thread_join_any (wrong order)\n");
+      printf(1, "Expected: %d, Real: %d\n", i+1, (int)retval);
+      return;
+    }
+    if (tid != threads[NUM_THREAD - 1 - i]){
+      printf(1, "panic at thread_join_any (wrong tid)\n");
+      return;
+    }
+  }
+
+  if (thread_join_any(&tid, &retval) != -1){
+    printf(1, "panic at thread_join_any (no thread left)\n");
+    return;
+  }
+  printf(1, "Test 1 is done!\n");
+}
+
+void*
+worker(void *arg)
+{
+  thread_exit(arg);
+}
+
+void
+test2()
+{
+  thread_t threads[NUM_THREAD];
+  thread_t tid;
+  int i, round;
+  void *retval;
+
+  // Detached threads are reaped by kernel, so that
+  // creating many of them never exhausts the thread table
+  for (round = 0; round < 20; round++){
+    for (i = 0; i < NUM_THREAD; i++){
+      if (thread_create(&threads[i], worker, (void*)i) != 0){
+        printf(1, "panic at thread_create\n");
+        return;
+      }
+      if (thread_detach(threads[i]) != 0){
+        printf(1, "panic at thread_detach\n");
+        return;
+      }
+    }
+    sleep(5);
+  }
+
+  // Detached thread could not be joined
+  if (thread_join(threads[0], &retval) != -1 ||
+      thread_join_any(&tid, &retval) != -1){
+    printf(1, "panic at thread_join (detached thread)\n");
+    return;
+  }
+  printf(1, "Test 2 is done!\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "===========Test1===========\n");
+  test1();
+
+  printf(1, "===========Test2===========\n");
+  test2();
+
+  printf(1, "All tests are done\n");
+
+  exit();
+}
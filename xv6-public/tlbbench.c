@@ -0,0 +1,71 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mman.h"
+
+// TLB-heavy benchmark: sweep an array touching one word per
+// page, so that every access needs a different 4KB translation,
+// in memory mapped with 4KB pages and with 4MB superpages.
+//
+// usage: tlbbench [megabytes]
+
+#define PGSIZE  4096
+#define NSWEEP  20
+
+volatile int sink;   // keeps the sweeps from being optimized away
+
+int
+sweep(int *a, int npages)
+{
+  int i, j, s, start;
+
+  // The first sweep faults the memory in.
+  for(i = 0; i < npages; i++)
+    a[i * (PGSIZE / 4)] = i;
+
+  start = uptime();
+  s = 0;
+  for(j = 0; j < NSWEEP; j++)
+    for(i = 0; i < npages; i++)
+      s += a[i * (PGSIZE / 4) + j];
+  sink = s;
+  return uptime() - start;
+}
+
+int
+run(int size, int flags)
+{
+  int *a, t;
+
+  a = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | flags, -1, 0);
+  if(a == MAP_FAILED)
+    return -1;
+  t = sweep(a, size / PGSIZE);
+  munmap(a, size);
+  return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, t;
+
+  mb = 64;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 4 || mb % 4){
+    printf(2, "usage: tlbbench [megabytes, a multiple of 4]\n");
+    exit();
+  }
+
+  printf(1, "%d sweeps over %dMB, one word per page\n", NSWEEP, mb);
+  if((t = run(mb * 1024 * 1024, 0)) < 0)
+    printf(1, "4KB pages: mmap failed\n");
+  else
+    printf(1, "4KB pages: %d ticks\n", t);
+  if((t = run(mb * 1024 * 1024, MAP_HUGE)) < 0)
+    printf(1, "4MB pages: mmap failed\n");
+  else
+    printf(1, "4MB pages: %d ticks\n", t);
+  exit();
+}
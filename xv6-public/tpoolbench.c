@@ -0,0 +1,214 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "threadpool.h"
+
+// Benchmark of the work-stealing thread pool.
+// Runs a parallel sum and a parallel mergesort with 1..N workers
+// and reports time in ticks and speedup against one worker.
+// Speedup is bounded by the number of CPUs, so run it
+// under e.g. `make qemu CPUS=8`.
+//
+// usage: tpoolbench [maxworkers]
+
+#define NSUM        (1024*1024)
+#define SUMREPEAT   20
+#define SUMGRAIN    8192
+#define NSORT       (128*1024)
+#define SORTGRAIN   2048
+
+int *sumdata;
+int *sortdata;
+int *sorttmp;
+
+int
+summap(int lo, int hi, void *arg)
+{
+  int *a = arg;
+  int i, s;
+
+  s = 0;
+  for(i = lo; i < hi; i++)
+    s += a[i];
+  return s;
+}
+
+int
+add(int x, int y)
+{
+  return x + y;
+}
+
+void
+merge(int *a, int *tmp, int lo, int mid, int hi)
+{
+  int i, j, k;
+
+  i = lo;
+  j = mid;
+  for(k = lo; k < hi; k++){
+    if(i < mid && (j >= hi || a[i] <= a[j]))
+      tmp[k] = a[i++];
+    else
+      tmp[k] = a[j++];
+  }
+  memmove(a + lo, tmp + lo, (hi - lo) * sizeof(int));
+}
+
+void
+seqsort(int *a, int *tmp, int lo, int hi)
+{
+  int i, j, v, mid;
+
+  if(hi - lo <= 16){
+    for(i = lo + 1; i < hi; i++){
+      v = a[i];
+      for(j = i; j > lo && a[j-1] > v; j--)
+        a[j] = a[j-1];
+      a[j] = v;
+    }
+    return;
+  }
+  mid = lo + (hi - lo) / 2;
+  seqsort(a, tmp, lo, mid);
+  seqsort(a, tmp, mid, hi);
+  merge(a, tmp, lo, mid, hi);
+}
+
+struct sortarg {
+  int lo, hi;
+};
+
+void
+parsort(void *p)
+{
+  struct sortarg *s = p;
+  struct sortarg left, right;
+  struct tptask t;
+  int mid;
+
+  if(s->hi - s->lo <= SORTGRAIN){
+    seqsort(sortdata, sorttmp, s->lo, s->hi);
+    return;
+  }
+  mid = s->lo + (s->hi - s->lo) / 2;
+  left.lo = s->lo;
+  left.hi = mid;
+  right.lo = mid;
+  right.hi = s->hi;
+  tp_spawn(&t, parsort, &left);
+  parsort(&right);
+  tp_sync(&t);
+  merge(sortdata, sorttmp, s->lo, mid, s->hi);
+}
+
+void
+fillsort(void)
+{
+  uint seed;
+  int i;
+
+  seed = 12345;
+  for(i = 0; i < NSORT; i++){
+    seed = seed * 1103515245 + 12345;
+    sortdata[i] = (seed >> 8) % 1000000;
+  }
+}
+
+int
+checksort(void)
+{
+  int i;
+
+  for(i = 1; i < NSORT; i++)
+    if(sortdata[i-1] > sortdata[i])
+      return -1;
+  return 0;
+}
+
+// Print x/100 as a fixed-point number.
+void
+printfix(int x)
+{
+  printf(1, "%d.%d%d", x / 100, (x / 10) % 10, x % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxworkers, n, i, expected, sum;
+  int sumticks, sortticks, sumbase, sortbase;
+  struct sortarg all;
+  uint start;
+
+  maxworkers = TP_MAXWORKERS;
+  if(argc > 1)
+    maxworkers = atoi(argv[1]);
+  if(maxworkers < 1 || maxworkers > TP_MAXWORKERS){
+    printf(2, "usage: tpoolbench [1-%d]\n", TP_MAXWORKERS);
+    exit();
+  }
+
+  sumdata = malloc(NSUM * sizeof(int));
+  sortdata = malloc(NSORT * sizeof(int));
+  sorttmp = malloc(NSORT * sizeof(int));
+  if(sumdata == 0 || sortdata == 0 || sorttmp == 0){
+    printf(2, "tpoolbench: out of memory\n");
+    exit();
+  }
+
+  expected = 0;
+  for(i = 0; i < NSUM; i++){
+    sumdata[i] = i % 7;
+    expected += i % 7;
+  }
+
+  printf(1, "workers\tsum\tspeedup\tsort\tspeedup\n");
+  sumbase = sortbase = 1;
+  for(n = 1; n <= maxworkers; n++){
+    if(tp_init(n) < 0){
+      printf(2, "tpoolbench: tp_init(%d) failed\n", n);
+      exit();
+    }
+
+    start = uptime();
+    for(i = 0; i < SUMREPEAT; i++){
+      sum = tp_reduce(0, NSUM, SUMGRAIN, summap, add, sumdata);
+      if(sum != expected){
+        printf(2, "tpoolbench: wrong sum %d, expected %d\n", sum, expected);
+        exit();
+      }
+    }
+    sumticks = uptime() - start;
+
+    fillsort();
+    all.lo = 0;
+    all.hi = NSORT;
+    start = uptime();
+    tp_run(parsort, &all);
+    sortticks = uptime() - start;
+    if(checksort() < 0){
+      printf(2, "tpoolbench: mergesort failed\n");
+      exit();
+    }
+
+    tp_exit();
+
+    if(sumticks == 0)
+      sumticks = 1;
+    if(sortticks == 0)
+      sortticks = 1;
+    if(n == 1){
+      sumbase = sumticks;
+      sortbase = sortticks;
+    }
+
+    printf(1, "%d\t%d\t", n, sumticks);
+    printfix(sumbase * 100 / sumticks);
+    printf(1, "\t%d\t", sortticks);
+    printfix(sortbase * 100 / sortticks);
+    printf(1, "\n");
+  }
+
+  exit();
+}
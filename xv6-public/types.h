@@ -1,5 +1,6 @@
 typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
+typedef unsigned long long uvlong;
 typedef uint pde_t;
 typedef uint thread_t;
@@ -2,89 +2,354 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mmu.h"
+#include "x86.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks come in size classes. The blocks of a class are
+// carved from one-page runs, and each thread (by its tid) keeps
+// a short list of free blocks of each class, so that most calls
+// to malloc() and free() take no lock. The lists are refilled
+// from and returned to the runs in batches, under one lock for
+// the whole heap. A larger block gets a run of pages of its own.
+//
+// Pages come from sbrk(). Free pages are kept in an address-ordered
+// list of spans and coalesced, and a large enough free span at the
+// top of the heap is given back with a negative sbrk().
 
-typedef long Align;
+#define NCLASS     16
+#define LARGE      NCLASS  // cls of the run of a large block
+#define HDRSIZE    32      // run header, at the start of its first page
+#define MAXSMALL   1016    // largest small block: 4 per run
+#define GROWPAGES  16      // fewest pages to ask sbrk() for
+#define TRIMPAGES  64      // free pages at the top worth giving back
+#define SPINS      64      // failed tries for the lock before yield()
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+static ushort classsize[NCLASS] = {
+  8, 16, 24, 32, 48, 64, 80, 96, 128, 160, 192, 256, 384, 512, 672, MAXSMALL,
 };
 
-typedef union header Header;
+// A free block of a size class.
+struct obj {
+  struct obj *next;
+};
 
-static Header base;
-static Header *freep;
+// Header of a run: a page of small blocks of one class,
+// or the pages of one large block.
+struct run {
+  ushort cls;         // size class, or LARGE
+  ushort nfree;       // free blocks in a small run
+  uint npages;        // pages of a large run
+  struct obj *free;   // free blocks in a small run
+  struct run *next;   // in the partial list of its class
+  struct run *prev;
+};
 
-void
-free(void *ap)
+// Free pages, at the start of the first one.
+struct span {
+  uint npages;
+  struct span *next;  // at a higher address
+};
+
+// Free blocks held by one thread.
+struct tcache {
+  struct obj *list[NCLASS];
+  ushort n[NCLASS];
+};
+
+static struct {
+  volatile uint locked;
+  volatile int ready;
+  uchar clsof[MAXSMALL/8 + 1];     // class of (nbytes+7)/8
+  ushort nobj[NCLASS];             // blocks in a run of each class
+  ushort batch[NCLASS];            // blocks moved at once to or from a thread
+  struct run *partial[NCLASS];     // runs with free blocks
+  struct span *spans;              // free pages, by address
+  uint top;                        // end of the last pages from sbrk()
+} heap;
+
+static struct tcache tcache[NTHREAD];
+
+// Tid of the calling thread, which the kernel keeps as the
+// limit of the SEG_UTID segment; cheaper than gettid().
+static int
+mytid(void)
+{
+  return lsl(SEG_UTID << 3 | DPL_USER);
+}
+
+static void
+lock(void)
+{
+  int spins;
+
+  for(spins = 0; xchg(&heap.locked, 1) != 0; )
+    if(++spins % SPINS == 0)
+      yield();
+}
+
+static void
+unlock(void)
+{
+  xchg(&heap.locked, 0);
+}
+
+static void
+heapinit(void)
+{
+  int c, i;
+
+  lock();
+  if(!heap.ready){
+    for(c = 0, i = 0; i <= MAXSMALL/8; i++){
+      if(i*8 > classsize[c])
+        c++;
+      heap.clsof[i] = c;
+    }
+    for(c = 0; c < NCLASS; c++){
+      heap.nobj[c] = (PGSIZE - HDRSIZE) / classsize[c];
+      heap.batch[c] = heap.nobj[c] / 2;
+      if(heap.batch[c] > 32)
+        heap.batch[c] = 32;
+      if(heap.batch[c] < 2)
+        heap.batch[c] = 2;
+    }
+    heap.ready = 1;
+  }
+  unlock();
+}
+
+// Give back the free span s at the top of the heap, whose
+// predecessor in the list is prev, if it is large enough and
+// nothing else has grown the address space above it. If
+// thread_create() puts a stack at the top after the check,
+// the kernel refuses to shrink past it and s stays free.
+// Caller holds the lock.
+static void
+trim(struct span *prev, struct span *s)
+{
+  uint n;
+
+  n = s->npages * PGSIZE;
+  if(s->npages < TRIMPAGES || (uint)s + n != heap.top || (uint)sbrk(0) != heap.top)
+    return;
+  if(sbrk(-n) == (char*)-1)
+    return;
+  if(prev)
+    prev->next = s->next;
+  else
+    heap.spans = s->next;
+  heap.top -= n;
+}
+
+// Free the n pages at p. Caller holds the lock.
+static void
+pagefree(char *p, uint n)
+{
+  struct span *s, *prev, *next;
+
+  s = (struct span*)p;
+  s->npages = n;
+  prev = 0;
+  for(next = heap.spans; next && next < s; next = next->next)
+    prev = next;
+  s->next = next;
+  if(next && (char*)s + n*PGSIZE == (char*)next){
+    s->npages += next->npages;
+    s->next = next->next;
+  }
+  if(prev && (char*)prev + prev->npages*PGSIZE == (char*)s){
+    prev->npages += s->npages;
+    prev->next = s->next;
+    s = prev;
+    prev = 0;
+    for(next = heap.spans; next != s; next = next->next)
+      prev = next;
+  } else if(prev)
+    prev->next = s;
+  else
+    heap.spans = s;
+  if(s->next == 0)
+    trim(prev, s);
+}
+
+// Allocate n pages, first fit. Caller holds the lock.
+static char*
+pagealloc(uint n)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  struct span *s, **pp;
+  uint top, grow, pad;
+  char *p;
+
+  for(pp = &heap.spans; (s = *pp) != 0; pp = &s->next){
+    if(s->npages == n){
+      *pp = s->next;
+      return (char*)s;
+    }
+    if(s->npages > n){
+      // Take the end, so the list need not change.
+      s->npages -= n;
+      return (char*)s + s->npages*PGSIZE;
+    }
+  }
+
+  grow = n < GROWPAGES ? GROWPAGES : n;
+  if(grow > (0x80000000 - PGSIZE) / PGSIZE)
+    return 0;
+  top = (uint)sbrk(0);
+  pad = PGROUNDUP(top) - top;
+  if((p = sbrk(pad + grow*PGSIZE)) == (char*)-1)
+    return 0;
+  p += pad;
+  heap.top = (uint)p + grow*PGSIZE;
+  if(grow > n)
+    pagefree(p + n*PGSIZE, grow - n);
+  return p;
 }
 
-static Header*
-morecore(uint nu)
+// Move up to batch blocks of class c to tc.
+static void
+refill(struct tcache *tc, int c)
 {
+  struct run *r;
+  struct obj *o;
   char *p;
-  Header *hp;
+  int i, j, size;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  size = classsize[c];
+  lock();
+  for(i = 0; i < heap.batch[c]; i++){
+    if((r = heap.partial[c]) == 0){
+      if((p = pagealloc(1)) == 0)
+        break;
+      r = (struct run*)p;
+      r->cls = c;
+      r->nfree = heap.nobj[c];
+      r->free = 0;
+      for(j = heap.nobj[c] - 1; j >= 0; j--){
+        o = (struct obj*)(p + HDRSIZE + j*size);
+        o->next = r->free;
+        r->free = o;
+      }
+      r->next = r->prev = 0;
+      heap.partial[c] = r;
+    }
+    o = r->free;
+    r->free = o->next;
+    if(--r->nfree == 0){
+      heap.partial[c] = r->next;
+      if(r->next)
+        r->next->prev = 0;
+    }
+    o->next = tc->list[c];
+    tc->list[c] = o;
+    tc->n[c]++;
+  }
+  unlock();
+}
+
+// Return n blocks of class c from the head of tc's list.
+static void
+flush(struct tcache *tc, int c, int n)
+{
+  struct run *r;
+  struct obj *o;
+
+  lock();
+  while(n-- > 0){
+    o = tc->list[c];
+    tc->list[c] = o->next;
+    tc->n[c]--;
+    r = (struct run*)PGROUNDDOWN((uint)o);
+    o->next = r->free;
+    r->free = o;
+    if(r->nfree++ == 0){
+      r->prev = 0;
+      r->next = heap.partial[c];
+      if(r->next)
+        r->next->prev = r;
+      heap.partial[c] = r;
+    }
+    if(r->nfree == heap.nobj[c] && (r->prev || r->next)){
+      // Empty, and not the last run of its class.
+      if(r->prev)
+        r->prev->next = r->next;
+      else
+        heap.partial[c] = r->next;
+      if(r->next)
+        r->next->prev = r->prev;
+      pagefree((char*)r, 1);
+    }
+  }
+  unlock();
+}
+
+static void*
+bigalloc(uint nbytes)
+{
+  struct run *r;
+  uint n;
+
+  if(nbytes > 0x80000000)
+    return 0;
+  n = PGROUNDUP(nbytes + HDRSIZE) / PGSIZE;
+  lock();
+  r = (struct run*)pagealloc(n);
+  unlock();
+  if(r == 0)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  r->cls = LARGE;
+  r->npages = n;
+  return (char*)r + HDRSIZE;
+}
+
+void
+free(void *ap)
+{
+  struct tcache *tc;
+  struct obj *o;
+  struct run *r;
+  int c;
+
+  if(ap == 0)
+    return;
+  r = (struct run*)PGROUNDDOWN((uint)ap);
+  if(r->cls == LARGE){
+    lock();
+    pagefree((char*)r, r->npages);
+    unlock();
+    return;
+  }
+  c = r->cls;
+  tc = &tcache[mytid()];
+  o = (struct obj*)ap;
+  o->next = tc->list[c];
+  tc->list[c] = o;
+  if(++tc->n[c] > 2*heap.batch[c])
+    flush(tc, c, heap.batch[c]);
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct tcache *tc;
+  struct obj *o;
+  int c;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  if(!heap.ready)
+    heapinit();
+  if(nbytes > MAXSMALL)
+    return bigalloc(nbytes);
+  c = heap.clsof[(nbytes+7)/8];
+  tc = &tcache[mytid()];
+  if(tc->list[c] == 0){
+    refill(tc, c);
+    if(tc->list[c] == 0)
+      return 0;
   }
+  o = tc->list[c];
+  tc->list[c] = o->next;
+  tc->n[c]--;
+  return o;
 }
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct procmem;
 
 // system calls
 int fork(void);
@@ -34,6 +36,19 @@ int thread_join(thread_t, void**);
 int gettid(void);
 int pwrite(int, void*, int, int);
 int pread(int, void*, int, int);
+int thread_join_any(thread_t*, void**);
+int thread_detach(thread_t);
+int fcntl(int, int, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int msync(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int spawn(char*, char**, int*, int);
+int memstat(struct memstat*);
+int procmem(struct procmem*, int);
 
 // ulib.c
 int stat(char*, struct stat*);
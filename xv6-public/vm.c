@@ -6,10 +6,55 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "vm.h"
+#include "mman.h"
+#include "memstat.h"
+
+#define TLBBATCH     64  // pages freed per TLB shootdown
+#define TLBFLUSHMAX  32  // flush more pages than this by reloading %cr3
+#define CLOCKBATCH   64  // pages the clock looks at per hold of vm->lock
+#define RECLAIMBATCH 32  // pages to free when an allocation fails
+
+#define SWAPSLOT(pte)  (PTE_ADDR(pte) / PGSIZE)
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Address spaces are allocated from a slab cache. vmtable.lock
+// protects the list of them and their ref counts.
+struct {
+  struct spinlock lock;
+  struct kmcache *cache;
+  struct vm *list;
+} vmtable;
+
+// The TLB shootdown in progress. Only one CPU at a time
+// sends shootdown IPIs, the others wait for shootdown.lock.
+struct {
+  struct spinlock lock;
+  pde_t *volatile pgdir;   // page table whose entries changed
+  volatile uint start;     // range of user addresses to flush
+  volatile uint end;
+  volatile uint pending;   // CPUs that have not flushed yet
+} shootdown;
+
+// Page replacement. The clock hand goes round the user pages
+// below sz of each address space in turn. A page accessed since
+// the hand last passed it (PTE_A) gets a second chance; one that
+// was not goes to swap, unless other page tables share it.
+// vmput() moves the hand on from an address space it frees, so
+// the hand is changed under vmtable.lock as well.
+struct {
+  struct sleeplock lock;   // one reclaim() at a time
+  struct vm *vm;           // the hand: vm at va, or 0 at the end of a lap
+  uint va;
+} clock;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -26,6 +71,7 @@ seginit(void)
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+  c->gdt[SEG_UTID] = SEG16(STA_W, 0, 0, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
 }
 
@@ -39,13 +85,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;   // a superpage has no page table
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -79,6 +126,34 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages, for the kernel part of a page table.
+// The 4MB-aligned parts of the range are mapped with superpages,
+// which need no page table and take one TLB entry each.
+static int
+mapkpages(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && size >= SUPERPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = SUPERPGSIZE;
+    } else {
+      n = SUPERPGSIZE - va % SUPERPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -92,13 +167,23 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+physend: mapped to V2P(data)..physend,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// Everything above the first 4MB of the kernel part is mapped
+// with 4MB superpages (see mapkpages). The kernel mappings are
+// the same in every page table and never change, so they are
+// global (PTE_G): loading %cr3 on a context switch flushes only
+// user entries from the TLB. Changing a kernel mapping would
+// have to flush it on every CPU, e.g. by toggling CR4_PGE.
+//
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (physend, as
+// reported by the BIOS but at most PHYSTOP), all of which is
+// directly addressable from end..P2V(physend). The kernel half
+// of the address space has room for PHYSTOP, so no memory needs
+// temporary mappings.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -110,7 +195,7 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory (to physend)
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
@@ -120,18 +205,20 @@ setupkvm(void)
 {
   pde_t *pgdir;
   struct kmap *k;
+  uint pend;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++){
+    pend = k->phys_end == PHYSTOP ? physend : k->phys_end;
+    if(mapkpages(pgdir, (uint)k->virt, pend - k->phys_start,
+                 (uint)k->phys_start, k->perm | PTE_G) < 0) {
       freevm(pgdir);
       return 0;
     }
+  }
   return pgdir;
 }
 
@@ -141,7 +228,7 @@ void
 kvmalloc(void)
 {
   kpgdir = setupkvm();
-  switchkvm();
+  lcr3(V2P(kpgdir));   // not switchkvm(): CPUs are not known yet
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -149,21 +236,35 @@ kvmalloc(void)
 void
 switchkvm(void)
 {
+  struct cpu *c;
+
+  pushcli();
+  c = mycpu();
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  // Only now, with no user entries left in the TLB,
+  // can shootdowns of the old address space skip this CPU.
+  if(c->vm)
+    atomic_and(&c->vm->cpumask, ~(1 << cpuid()));
+  c->vm = 0;
+  popcli();
 }
 
 // Switch TSS and h/w page table to correspond to process p.
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+  struct vm *old;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
     panic("switchuvm: no kstack");
-  if(p->pgdir == 0)
+  if(p->vm == 0 || p->vm->pgdir == 0)
     panic("switchuvm: no pgdir");
 
   pushcli();
+  c = mycpu();
   mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
                                 sizeof(mycpu()->ts)-1, 0);
   mycpu()->gdt[SEG_TSS].s = 0;
@@ -173,7 +274,17 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // Let user code read its tid with lsl, without a system call.
+  c->gdt[SEG_UTID] = SEG16(STA_W, 0, p->tid, DPL_USER);
+  // Join the CPU mask of the new address space before loading it,
+  // and leave the old one only after, so no shootdown misses us.
+  old = c->vm;
+  if(old != p->vm)
+    atomic_or(&p->vm->cpumask, 1 << cpuid());
+  lcr3(V2P(p->vm->pgdir));  // switch to process's address space
+  if(old && old != p->vm)
+    atomic_and(&old->cpumask, ~(1 << cpuid()));
+  c->vm = p->vm;
   popcli();
 }
 
@@ -186,38 +297,15 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// If memory runs short, pages of other processes go to swap, so
+// the caller must not hold spinlocks.
 int
 allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -231,13 +319,13 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    while((mem = kalloc_zeroed()) == 0 && reclaim(RECLAIMBATCH) > 0)
+      ;
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,36 +336,163 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
-// Deallocate user pages to bring the process size from oldsz to
-// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
-// need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
-int
-deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+// Flush TLB entries of this CPU for user addresses [start, end).
+// Large ranges reload %cr3 instead of invalidating page by page.
+static void
+flushrange(uint start, uint end)
+{
+  uint a;
+
+  if(end - start > TLBFLUSHMAX*PGSIZE){
+    lcr3(rcr3());
+    return;
+  }
+  for(a = start; a < end; a += PGSIZE)
+    invlpg((void*)a);
+}
+
+// Make sure no CPU has a TLB entry for user addresses [start, end)
+// of address space vm, whose page table entries the caller has
+// just changed. Sends an IPI to each other CPU running on vm and
+// waits until all of them have flushed.
+// May be called with locks held: CPUs spinning for a lock
+// (with interrupts off) flush in acquire().
+void
+tlbshootdown(struct vm *vm, uint start, uint end)
+{
+  uint self, mask;
+  int i;
+
+  pushcli();
+  self = 1 << cpuid();
+  // Make the page table updates visible to CPUs that join
+  // vm from now on before looking at who is running on it.
+  __sync_synchronize();
+  if(vm->cpumask & self)
+    flushrange(start, end);
+  mask = vm->cpumask & ~self;
+  if(mask == 0){
+    popcli();
+    return;
+  }
+
+  acquire(&shootdown.lock);
+  shootdown.pgdir = vm->pgdir;
+  shootdown.start = start;
+  shootdown.end = end;
+  shootdown.pending = mask;
+  for(i = 0; i < ncpu; i++)
+    if(mask & (1 << i))
+      lapicipi(cpus[i].apicid, T_TLBFLUSH);
+  while(shootdown.pending)
+    ;
+  release(&shootdown.lock);
+  popcli();
+}
+
+// Do this CPU's part of the shootdown in progress, if any.
+// Called with interrupts disabled.
+void
+tlbflushpending(void)
+{
+  uint self;
+
+  if(shootdown.pending == 0)
+    return;
+  self = 1 << cpuid();
+  if((shootdown.pending & self) == 0)
+    return;
+  // A CPU that has switched to another page table since
+  // has no entries of shootdown.pgdir left.
+  if(rcr3() == V2P(shootdown.pgdir))
+    flushrange(shootdown.start, shootdown.end);
+  atomic_and(&shootdown.pending, ~self);
+}
+
+// Unmap and free the user pages of pgdir from oldsz down to newsz.
+// If vm is not 0, other CPUs may be running on pgdir: the pages are
+// collected in batches, and a batch is freed only after one
+// shootdown for its whole range.
+static int
+unmapuvm(pde_t *pgdir, struct vm *vm, uint oldsz, uint newsz)
 {
   pte_t *pte;
-  uint a, pa;
+  uint a, pa, start, end;
+  uint batch[TLBBATCH];
+  int i, n;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  n = 0;
+  start = end = 0;
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      // Superpage of a MAP_HUGE region, which is unmapped whole.
+      pa = PTE_ADDR(pgdir[PDX(a)]);
+      pgdir[PDX(a)] = 0;
+      if(vm)
+        tlbshootdown(vm, a, a + SUPERPGSIZE);
+      kfree_order(P2V(pa), SUPERPGORDER);
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
+    else if(*pte & PTE_SWAP){
+      swapfree(SWAPSLOT(*pte));
+      *pte = 0;
+    } else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
       *pte = 0;
+      if(vm == 0){
+        kfree(P2V(pa));
+        continue;
+      }
+      if(n == 0)
+        start = a;
+      end = a + PGSIZE;
+      batch[n++] = pa;
+      if(n == TLBBATCH){
+        tlbshootdown(vm, start, end);
+        for(i = 0; i < n; i++)
+          kfree(P2V(batch[i]));
+        n = 0;
+      }
     }
   }
+  if(n > 0){
+    tlbshootdown(vm, start, end);
+    for(i = 0; i < n; i++)
+      kfree(P2V(batch[i]));
+  }
   return newsz;
 }
 
+// Deallocate user pages to bring the process size from oldsz to
+// newsz.  oldsz and newsz need not be page-aligned, nor does newsz
+// need to be less than oldsz.  oldsz can be larger than the actual
+// process size.  Returns the new process size.
+// pgdir must not be in use by any CPU; see vmdealloc().
+int
+deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  return unmapuvm(pgdir, 0, oldsz, newsz);
+}
+
+// Like deallocuvm, for address space vm which threads may be
+// running on. Stale TLB entries are shot down on all CPUs.
+// Caller must hold vm->lock.
+int
+vmdealloc(struct vm *vm, uint oldsz, uint newsz)
+{
+  return unmapuvm(vm->pgdir, vm, oldsz, newsz);
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -289,7 +504,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -310,32 +525,76 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+// Share the present pages of [start, end) of vm with page
+// table d. Unless shared is set, writable pages become
+// copy-on-write in both page tables. Pages out on swap are
+// shared by their slot.
+static int
+sharerange(struct vm *vm, pde_t *d, uint start, uint end, int shared)
 {
-  pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *dpte;
   uint pa, i, flags;
-  char *mem;
 
-  if((d = setupkvm()) == 0)
-    return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+  for(i = start; i < end; i += PGSIZE){
+    if(vm->pgdir[PDX(i)] & PTE_PS){
+      // Superpages are only in MAP_SHARED regions.
+      d[PDX(i)] = vm->pgdir[PDX(i)];
+      kref(P2V(PTE_ADDR(d[PDX(i)])));
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    // Pages grown by sbrk() but never touched are not there yet.
+    if((pte = walkpgdir(vm->pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      if((dpte = walkpgdir(d, (void*)i, 1)) == 0)
+        return -1;
+      *dpte = *pte;
+      swapdup(SWAPSLOT(*pte));
+      continue;
+    }
     if(!(*pte & PTE_P))
-      //panic("copyuvm: page not present");
-      continue; // Ignore
+      continue;
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
-      goto bad;
+    // Writeback of a shared page goes by the parent's PTE_D.
+    if(shared)
+      flags &= ~PTE_D;
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kref(P2V(pa));
   }
+  return 0;
+}
+
+// Given a parent process's address space, create a page table
+// for a child that shares all of its pages copy-on-write:
+// writable pages become read-only in both page tables, and
+// pagefault() copies them on the first write. Pages of
+// MAP_SHARED regions stay writable and shared.
+// Caller must hold vm->lock.
+pde_t*
+copyuvm(struct vm *vm)
+{
+  pde_t *d;
+  struct vma *v;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  if(sharerange(vm, d, 0, vm->sz, 0) < 0)
+    goto bad;
+  // Program segments are below sz, and shared already.
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+    if(v->end && v->start >= MMAPBASE &&
+       sharerange(vm, d, v->start, v->end, v->flags & MAP_SHARED) < 0)
+      goto bad;
+  // Other threads of the parent may still have
+  // the pages cached as writable.
+  tlbshootdown(vm, 0, KERNBASE);
   return d;
 
 bad:
@@ -343,6 +602,496 @@ bad:
   return 0;
 }
 
+// If the page at va in vm is present and dirty, clear its dirty
+// bit and return its physical address with a reference taken,
+// so that it can be written back without vm->lock. Otherwise
+// return 0. The caller must shoot down the page before the next
+// write can be relied on to set PTE_D again.
+// Caller must hold vm->lock.
+uint
+takedirty(struct vm *vm, uint va)
+{
+  pte_t *pte;
+  uint pa;
+
+  pte = walkpgdir(vm->pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+    return 0;
+  *pte &= ~PTE_D;
+  pa = PTE_ADDR(*pte);
+  kref(P2V(pa));
+  return pa;
+}
+
+void
+vminit(void)
+{
+  initlock(&vmtable.lock, "vmtable");
+  vmtable.cache = kmcreate("vm", sizeof(struct vm), 0);
+  initlock(&shootdown.lock, "shootdown");
+  initsleeplock(&clock.lock, "clock");
+}
+
+// Allocate an address space for page table pgdir,
+// holding sz bytes of user memory.
+// Returns 0 if out of memory.
+struct vm*
+vmcreate(pde_t *pgdir, uint sz)
+{
+  struct vm *vm;
+
+  if((vm = kmalloc(vmtable.cache)) == 0)
+    return 0;
+  memset(vm, 0, sizeof(*vm));
+  initlock(&vm->lock, "vm");
+  vm->pgdir = pgdir;
+  vm->sz = sz;
+  vm->ref = 1;
+
+  // reclaim() looks at every vm on the list.
+  acquire(&vmtable.lock);
+  vm->next = vmtable.list;
+  if(vmtable.list)
+    vmtable.list->prev = vm;
+  vmtable.list = vm;
+  release(&vmtable.lock);
+  return vm;
+}
+
+// Increment ref count for address space vm.
+struct vm*
+vmdup(struct vm *vm)
+{
+  acquire(&vmtable.lock);
+  if(vm->ref < 1)
+    panic("vmdup");
+  vm->ref++;
+  release(&vmtable.lock);
+  return vm;
+}
+
+// Drop a reference to address space vm. When the last
+// thread using it is gone, free its page table and memory.
+void
+vmput(struct vm *vm)
+{
+  pde_t *pgdir;
+
+  acquire(&vmtable.lock);
+  if(vm->ref < 1)
+    panic("vmput");
+  if(--vm->ref > 0){
+    release(&vmtable.lock);
+    return;
+  }
+  pgdir = vm->pgdir;
+  if(vm->prev)
+    vm->prev->next = vm->next;
+  else
+    vmtable.list = vm->next;
+  if(vm->next)
+    vm->next->prev = vm->prev;
+  if(clock.vm == vm){
+    clock.vm = vm->next;
+    clock.va = 0;
+  }
+  release(&vmtable.lock);
+
+  freevm(pgdir);
+  kmfree(vmtable.cache, vm);
+}
+
+// Map a zeroed superpage at va in a MAP_HUGE region of vm,
+// with permissions perm, and release vm->lock.
+// Returns 0 if the faulting access can be retried,
+// -1 if it is an error.
+static int
+superfault(struct vm *vm, uint va, int perm)
+{
+  pde_t *pde;
+  struct vma *v;
+  char *mem;
+  int i;
+
+  pde = &vm->pgdir[PDX(va)];
+  if(*pde & PTE_P){
+    // Stale TLB entry, as in pagefault().
+    invlpg((void*)va);
+    release(&vm->lock);
+    return 0;
+  }
+
+  // Zeroing 4MB takes a while: do it without vm->lock, and let
+  // the access retry if another thread mapped the superpage or
+  // the region went away meanwhile.
+  release(&vm->lock);
+  if((mem = kalloc_order(SUPERPGORDER)) == 0)
+    return -1;
+  for(i = 0; i < SUPERPGSIZE; i += PGSIZE)
+    pagezero(mem + i);
+  acquire(&vm->lock);
+  if((v = mmapfind(vm, va)) == 0 || (v->flags & MAP_HUGE) == 0 || (*pde & PTE_P)){
+    release(&vm->lock);
+    kfree_order(mem, SUPERPGORDER);
+    return 0;
+  }
+  *pde = V2P(mem) | perm | PTE_P | PTE_PS;
+  release(&vm->lock);
+  return 0;
+}
+
+// Bring the page at va of vm, whose PTE is pte, back from swap
+// into a page of its own, and release vm->lock.
+// Returns as pagefault().
+static int
+swapfault(struct vm *vm, uint va, pte_t *pte)
+{
+  pte_t old;
+  uint slot;
+  char *mem;
+
+  // Reading the slot sleeps: hold it so that it cannot be reused
+  // meanwhile, and let the access retry if another thread brought
+  // the page in or it went away.
+  old = *pte;
+  slot = SWAPSLOT(old);
+  swapdup(slot);
+  release(&vm->lock);
+  if((mem = kalloc()) == 0){
+    swapfree(slot);
+    return reclaim(RECLAIMBATCH) > 0 ? 0 : -1;
+  }
+  swapread(mem, slot);
+  acquire(&vm->lock);
+  if(*pte == old){
+    // Just used: not the clock's next victim.
+    *pte = V2P(mem) | (old & (PTE_W|PTE_U)) | PTE_A | PTE_P;
+    swapfree(slot);
+    mem = 0;
+  }
+  release(&vm->lock);
+  swapfree(slot);
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Back the page at va of file region v of vm, with permissions
+// perm, and release vm->lock. Whole pages of private regions,
+// which include program segments, come from the text cache and
+// are shared copy-on-write; the others are read into a page of
+// their own. Returns as pagefault().
+static int
+filefault(struct vm *vm, struct vma *v, uint va, int perm)
+{
+  struct file *f;
+  uint off, n;
+  pte_t *pte;
+  char *mem;
+
+  // Reading the file sleeps, so do it without vm->lock, and
+  // let the access retry if the region went away or another
+  // thread filled the page meanwhile.
+  f = filedup(v->f);
+  off = v->off + (va - v->start);
+  n = v->flen - (va - v->start);
+  if((v->flags & MAP_PRIVATE) && n >= PGSIZE){
+    release(&vm->lock);
+    mem = textpage(f->ip, off);
+    if(perm & PTE_W)
+      perm = (perm & ~PTE_W) | PTE_COW;
+  } else {
+    release(&vm->lock);
+    if((mem = kalloc_zeroed()) != 0)
+      mmapread(f, mem, off, n < PGSIZE ? n : PGSIZE);
+  }
+  fileclose(f);
+  if(mem == 0)
+    return reclaim(RECLAIMBATCH) > 0 ? 0 : -1;
+
+  acquire(&vm->lock);
+  pte = walkpgdir(vm->pgdir, (char*)va, 0);
+  if((v = mmapfind(vm, va)) == 0 || v->f != f || (pte && (*pte & (PTE_P|PTE_SWAP)))){
+    kfree(mem);
+    release(&vm->lock);
+    return 0;
+  }
+  // Accessed, as in pagefault().
+  if(mappages(vm->pgdir, (char*)va, PGSIZE, V2P(mem), perm|PTE_A) < 0){
+    kfree(mem);
+    release(&vm->lock);
+    return -1;
+  }
+  release(&vm->lock);
+  return 0;
+}
+
+// Handle a page fault at va in the current process's address
+// space, with error code err. Memory grown by sbrk(), mapped
+// with mmap() or holding a program segment is backed by a page on
+// first touch: zeroed, from the mapped file (see filefault), or a
+// page of a shared-memory segment. A write to a copy-on-write page
+// gets a private copy of the page, or just makes the page
+// writable if no one else shares it any more. Pages on swap are
+// read back. If memory runs short, other pages go to swap first.
+// Returns 0 if the faulting access can be retried,
+// -1 if it is an error.
+int
+pagefault(uint va, uint err)
+{
+  struct vm *vm = myproc()->vm;
+  struct vma *v;
+  pte_t *pte;
+  uint pa, flags;
+  int perm;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+
+  acquire(&vm->lock);
+  v = mmapfind(vm, va);
+  perm = PTE_W|PTE_U;
+  if(va >= vm->sz){
+    if(v == 0)
+      goto bad;
+    if((err & FEC_WR) && (v->prot & PROT_WRITE) == 0)
+      goto bad;
+    perm = (v->prot & PROT_WRITE) ? PTE_W|PTE_U : PTE_U;
+  }
+  if(v && (v->flags & MAP_HUGE))
+    return superfault(vm, va, perm);
+  pte = walkpgdir(vm->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_SWAP))
+    return swapfault(vm, PGROUNDDOWN(va), pte);
+  if(pte == 0 || (*pte & PTE_P) == 0){
+    // Lazily allocated page. Other threads cannot
+    // have it in their TLBs.
+    va = PGROUNDDOWN(va);
+    if(v && v->f && va - v->start < v->flen)
+      return filefault(vm, v, va, perm);
+    if(v && v->shm)
+      mem = shmpage(v->shm, (v->off + va - v->start) / PGSIZE);
+    else
+      mem = kalloc_zeroed();
+    if(mem == 0)
+      goto oom;
+    // Mapped accessed, so that the clock does not take the page
+    // before the access that faulted it in has used it.
+    if(mappages(vm->pgdir, (char*)va, PGSIZE, V2P(mem), perm|PTE_A) < 0){
+      kfree(mem);
+      goto bad;
+    }
+    release(&vm->lock);
+    return 0;
+  }
+  if((err & FEC_U) && (*pte & PTE_U) == 0)
+    goto bad;
+  if((err & FEC_WR) == 0 || (*pte & PTE_W)){
+    // Stale TLB entry: another thread has already
+    // resolved the fault.
+    invlpg((void*)va);
+    release(&vm->lock);
+    return 0;
+  }
+  if((*pte & PTE_COW) == 0)
+    goto bad;
+
+  va = PGROUNDDOWN(va);
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcount(P2V(pa)) == 1){
+    // Other threads may keep the read-only entry
+    // until they fault on it, see above.
+    *pte = pa | flags;
+    invlpg((void*)va);
+  } else {
+    if((mem = kalloc()) == 0)
+      goto oom;
+    pagecopy(mem, P2V(pa));
+    *pte = V2P(mem) | flags;
+    tlbshootdown(vm, va, va + PGSIZE);
+    kfree(P2V(pa));
+  }
+  release(&vm->lock);
+  return 0;
+
+bad:
+  release(&vm->lock);
+  return -1;
+
+oom:
+  // Retry once some pages have gone to swap.
+  release(&vm->lock);
+  return reclaim(RECLAIMBATCH) > 0 ? 0 : -1;
+}
+
+// Fill in the memory counts of pm for address space vm,
+// which the caller holds a reference to, not counted as a thread.
+void
+uvmstat(struct vm *vm, struct procmem *pm)
+{
+  pde_t pde;
+  pte_t *pgtab;
+  int i, j;
+
+  acquire(&vm->lock);
+  pm->size = PGROUNDUP(vm->sz) / PGSIZE;
+  pm->nthread = vm->ref - 1;
+  pm->idlestacks = vm->blankvm.size;
+  pm->rss = pm->swapped = 0;
+  pm->ptpages = 1;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    pde = vm->pgdir[i];
+    if((pde & PTE_P) == 0)
+      continue;
+    if(pde & PTE_PS){
+      pm->rss += NPTENTRIES;
+      continue;
+    }
+    pm->ptpages++;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pde));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_P)
+        pm->rss++;
+      else if(pgtab[j] & PTE_SWAP)
+        pm->swapped++;
+    }
+  }
+  release(&vm->lock);
+}
+
+// Whether the page at va of vm is present. Without vm->lock
+// this is only a hint, but page tables are not freed while
+// vm is in use, so it is safe to look.
+int
+uvmpresent(struct vm *vm, uint va)
+{
+  pte_t *pte;
+
+  if(vm->pgdir[PDX(va)] & PTE_PS)
+    return 1;
+  pte = walkpgdir(vm->pgdir, (char*)va, 0);
+  return pte && (*pte & PTE_P);
+}
+
+// Write the page at va of vm, whose PTE is pte, to swap and free
+// it. vm->lock is held, but released while the page is written.
+// Returns 1 if the page was freed, 0 if it was not, -1 if there
+// is no swap space left.
+static int
+evict(struct vm *vm, uint va, pte_t *pte)
+{
+  pte_t old;
+  uint pa;
+  int slot, freed;
+
+  if((slot = swapalloc()) < 0)
+    return -1;
+  // The extra reference makes writes during the write-out get a
+  // copy of the page from pagefault(), and the page is kept only
+  // if it changed hands meanwhile.
+  old = *pte;
+  pa = PTE_ADDR(old);
+  kref(P2V(pa));
+  if(old & PTE_W){
+    *pte = (old & ~PTE_W) | PTE_COW;
+    tlbshootdown(vm, va, va + PGSIZE);
+  }
+  release(&vm->lock);
+  swapwrite(P2V(pa), slot);
+  acquire(&vm->lock);
+
+  freed = 0;
+  if((*pte & PTE_P) && PTE_ADDR(*pte) == pa && krefcount(P2V(pa)) == 2){
+    *pte = slot*PGSIZE | PTE_SWAP | (old & PTE_U) |
+           ((old & (PTE_W|PTE_COW)) ? PTE_W : 0);
+    tlbshootdown(vm, va, va + PGSIZE);
+    kfree(P2V(pa));
+    freed = 1;
+  } else
+    swapfree(slot);
+  kfree(P2V(pa));
+  return freed;
+}
+
+// Free up to n pages of user memory, first cached program text
+// that no process maps, then pages written to swap.
+// Returns the number of pages freed, 0 if no page could go.
+// Caller must not hold spinlocks.
+int
+reclaim(int n)
+{
+  struct vm *vm;
+  pte_t *pte, *victim;
+  uint start, end, sz;
+  int freed, laps, scanned, r;
+
+  // Cached program text that nothing maps is cheapest to lose.
+  if((freed = textshrink(n)) >= n)
+    return freed;
+
+  acquiresleep(&clock.lock);
+  // Two whole laps take away every page's second chance.
+  for(laps = 0; freed < n && laps <= 2; ){
+    acquire(&vmtable.lock);
+    if((vm = clock.vm) == 0){
+      clock.vm = vmtable.list;
+      clock.va = 0;
+      laps++;
+      release(&vmtable.lock);
+      continue;
+    }
+    vm->ref++;
+    release(&vmtable.lock);
+    r = 0;
+    acquire(&vm->lock);
+    victim = 0;
+    start = end = 0;
+    for(scanned = 0; scanned < CLOCKBATCH && clock.va < vm->sz; clock.va += PGSIZE){
+      if((pte = walkpgdir(vm->pgdir, (char*)clock.va, 0)) == 0){
+        clock.va = PGADDR(PDX(clock.va) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+        continue;
+      scanned++;
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        if(end == 0)
+          start = clock.va;
+        end = clock.va + PGSIZE;
+      } else if(krefcount(P2V(PTE_ADDR(*pte))) == 1){
+        victim = pte;
+        break;
+      }
+    }
+    // The next access must set PTE_A again.
+    if(end)
+      tlbshootdown(vm, start, end);
+    if(victim){
+      if((r = evict(vm, clock.va, victim)) > 0)
+        freed++;
+      clock.va += PGSIZE;
+    }
+    sz = vm->sz;
+    release(&vm->lock);
+
+    // Move on while vm still has our reference.
+    acquire(&vmtable.lock);
+    if(r >= 0 && clock.va >= sz){
+      clock.vm = vm->next;
+      clock.va = 0;
+    }
+    release(&vmtable.lock);
+    vmput(vm);
+    if(r < 0)
+      break;
+  }
+  releasesleep(&clock.lock);
+  return freed;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -0,0 +1,37 @@
+// When thread is cleaned up, its memeory spaces is saved to blankvm of
+// address space so that new thread could use memory space in blankvm,
+// not by growing sz of address space
+struct blankvm {
+  uint data[NTHREAD];
+  int size;
+};
+
+// A region mapped with mmap(), or a program segment mapped by
+// exec() below sz. Unused if end is 0.
+struct vma {
+  uint start;                  // page-aligned, in [MMAPBASE, KERNBASE) if mmap()ed
+  uint end;
+  int prot;                    // PROT_ flags
+  int flags;                   // MAP_ flags
+  struct file *f;              // mapped file, 0 if MAP_ANON
+  struct shm *shm;             // attached shared-memory segment, or 0
+  uint off;                    // file offset of start
+  uint flen;                   // bytes of f mapped from off; the rest is zeroed
+};
+
+// Address space of a process.
+// Shared by master and all of its slave threads, so that
+// sbrk() and thread stack allocation of one process do not
+// need ptable.lock.
+struct vm {
+  struct spinlock lock;        // protects sz, blankvm, vma and updates of pgdir
+  int ref;                     // Number of threads using this address space
+  pde_t* pgdir;                // Page table
+  uint sz;                     // Size of process memory (bytes)
+  uint stacktop;               // End of the highest thread stack below sz
+  volatile uint cpumask;       // CPUs (bit i is cpus[i]) with pgdir in %cr3
+  struct blankvm blankvm;      // Blanks of memory space left by cleaned-up threads
+  struct vma vma[NVMA];        // Regions mapped with mmap() or exec()
+  struct vm *next;             // On the list of all address spaces
+  struct vm *prev;
+};
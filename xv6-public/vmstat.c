@@ -0,0 +1,111 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// Report memory statistics, in pages.
+//
+// usage: vmstat [ticks [count]]
+//        vmstat -p
+//
+// With ticks, print a line every ticks clock ticks, count times
+// or until killed; alloc and freed are the pages allocated and
+// freed since the line before, or since boot for the first one.
+// With -p, list the memory of each process: size of its address
+// space, resident pages, pages on swap, page table pages, threads,
+// and stacks left behind by exited threads.
+
+// Print n right-aligned in a field of w characters.
+void
+putn(uint n, int w)
+{
+  char buf[12];
+  int i;
+
+  i = sizeof(buf);
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n && i > 0);
+  for(w -= sizeof(buf) - 1 - i; w > 0; w--)
+    printf(1, " ");
+  printf(1, "%s", buf + i);
+}
+
+void
+procs(void)
+{
+  struct procmem *pm;
+  int i, n, max;
+
+  // There is no fixed number of processes: ask again with
+  // more room until it is not all used.
+  pm = 0;
+  n = max = 32;
+  while(n == max){
+    free(pm);
+    max *= 2;
+    if((pm = malloc(max * sizeof(*pm))) == 0 || (n = procmem(pm, max)) < 0){
+      printf(2, "vmstat: procmem failed\n");
+      exit();
+    }
+  }
+  printf(1, "  pid     size      rss     swap   pt  thr idle name\n");
+  for(i = 0; i < n; i++){
+    putn(pm[i].pid, 5);
+    putn(pm[i].size, 9);
+    putn(pm[i].rss, 9);
+    putn(pm[i].swapped, 9);
+    putn(pm[i].ptpages, 5);
+    putn(pm[i].nthread, 5);
+    putn(pm[i].idlestacks, 5);
+    printf(1, " %s\n", pm[i].name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat ms;
+  uint nalloc, nfree;
+  int ticks, count, i;
+
+  if(argc > 1 && strcmp(argv[1], "-p") == 0){
+    procs();
+    exit();
+  }
+  ticks = 0;
+  count = 1;
+  if(argc > 1){
+    ticks = atoi(argv[1]);
+    count = argc > 2 ? atoi(argv[2]) : 0;
+    if(ticks <= 0){
+      printf(2, "usage: vmstat [ticks [count]] | vmstat -p\n");
+      exit();
+    }
+  }
+
+  printf(1, "    free  zeroed    swap    text  bufs    alloc    freed\n");
+  nalloc = nfree = 0;
+  for(i = 0; count == 0 || i < count; i++){
+    if(i > 0)
+      sleep(ticks);
+    if(memstat(&ms) < 0){
+      printf(2, "vmstat: memstat failed\n");
+      exit();
+    }
+    putn(ms.free, 8);
+    putn(ms.zeroed, 8);
+    putn(ms.swapused, 8);
+    putn(ms.text, 8);
+    putn(ms.bufvalid, 6);
+    putn(ms.nalloc - nalloc, 9);
+    putn(ms.nfree - nfree, 9);
+    printf(1, "\n");
+    nalloc = ms.nalloc;
+    nfree = ms.nfree;
+  }
+  exit();
+}
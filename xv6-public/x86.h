@@ -57,6 +57,24 @@ stosl(void *addr, int data, int cnt)
                "memory", "cc");
 }
 
+static inline void
+movsb(void *dst, const void *src, int cnt)
+{
+  asm volatile("cld; rep movsb" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
+static inline void
+movsl(void *dst, const void *src, int cnt)
+{
+  asm volatile("cld; rep movsl" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
 struct segdesc;
 
 static inline void
@@ -130,6 +148,59 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically set *addr to newval if it equals expected.
+// Returns the old value of *addr (== expected on success).
+static inline uint
+cmpxchg(volatile uint *addr, uint expected, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (expected) :
+               "memory", "cc");
+  return result;
+}
+
+// Atomically set the bits of mask in *addr.
+static inline void
+atomic_or(volatile uint *addr, uint mask)
+{
+  asm volatile("lock; orl %1, %0" : "+m" (*addr) : "r" (mask) : "memory", "cc");
+}
+
+// Atomically clear all bits of *addr that are not in mask.
+static inline void
+atomic_and(volatile uint *addr, uint mask)
+{
+  asm volatile("lock; andl %1, %0" : "+m" (*addr) : "r" (mask) : "memory", "cc");
+}
+
+// Atomically add val to *addr. Returns the old value of *addr.
+static inline int
+xadd(volatile int *addr, int val)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (val), "+m" (*addr) :
+               :
+               "memory", "cc");
+  return val;
+}
+
+static inline uint
+rcr0(void)
+{
+  uint val;
+  asm volatile("movl %%cr0,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr0(uint val)
+{
+  asm volatile("movl %0,%%cr0" : : "r" (val));
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +215,66 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
+static inline uint
+rcr4(void)
+{
+  uint val;
+  asm volatile("movl %%cr4,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr4(uint val)
+{
+  asm volatile("movl %0,%%cr4" : : "r" (val));
+}
+
+// Return the feature flags in %edx of cpuid leaf 1.
+static inline uint
+cpuidfeatures(void)
+{
+  uint a, b, c, d;
+
+  asm volatile("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+  return d;
+}
+
+// Read the time-stamp counter.
+static inline uvlong
+rdtsc(void)
+{
+  uvlong val;
+
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
+// Return the limit of the segment selected by sel,
+// or 0 if it cannot be seen at the current privilege level.
+static inline uint
+lsl(uint sel)
+{
+  uint lim = 0;
+
+  asm volatile("lsl %1, %0" : "+r" (lim) : "r" (sel) : "cc");
+  return lim;
+}
+
+// Flush the TLB entry for the page containing va.
+static inline void
+invlpg(void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().